@@ -4,18 +4,41 @@
 
 #include "BasicPitch.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <thread>
+#include <utility>
+
+BasicPitch::~BasicPitch() {
+  {
+    std::lock_guard<std::mutex> lock(mStreamMutex);
+    mStreamEnded = true;
+  }
+  mStreamCondition.notify_all();
+
+  for (auto &thread : mStreamThreads) {
+    thread.join();
+  }
+}
+
 void BasicPitch::reset() {
-  mBasicPitchCNN.reset();
+  for (auto &worker : mWorkers) {
+    worker->cnn.reset();
+  }
+
   mNotesCreator.clear();
 
   mContoursPG.clear();
-  mContoursPG.shrink_to_fit();
   mNotesPG.clear();
-  mNotesPG.shrink_to_fit();
   mOnsetsPG.clear();
-  mOnsetsPG.shrink_to_fit();
   mNoteEvents.clear();
   mNoteEvents.shrink_to_fit();
+  mChroma.fill(0.0f);
+
+  mStreamAudio.clear();
+  mStreamAudio.shrink_to_fit();
 
   mNumFrames = 0;
 }
@@ -34,67 +57,579 @@ void BasicPitch::setParameters(float inNoteSensitivity,
   mParams.inferOnsets = true;
 }
 
-void BasicPitch::transcribeToMIDI(float *inAudio, int inNumSamples) {
-  const float *stacked_cqt =
-      mFeaturesCalculator.computeFeatures(inAudio, inNumSamples, mNumFrames);
+void BasicPitch::setNumThreads(size_t inNumThreads) {
+  mNumThreads = std::max<size_t>(inNumThreads, 1);
+}
+
+void BasicPitch::setSingleFeaturesCall(bool inSingleCall) {
+  mSingleFeaturesCall = inSingleCall;
+}
+
+void BasicPitch::setFeaturesSessionParams(
+    const Features::SessionParams &inParams) {
+  mFeaturesParams = inParams;
+
+  std::lock_guard<std::mutex> lock(mWorkersMutex);
+  mWorkers.clear();
+}
+
+void BasicPitch::transcribeToMIDI(const float *inAudio, int inNumSamples) {
+  const auto num_samples = static_cast<size_t>(inNumSamples);
+
+  mNumFramesDone = 0;
+  mNumFramesExpected = 0;
+
+  _prepareWorkers(1);
+
+  try {
+    // Posteriorgrams are allocated once so that shards can fill them
+    // concurrently.
+    mNumFrames =
+        _computeNumFrames(mWorkers[0]->features, inAudio, num_samples);
+    mNumFramesExpected = mNumFrames;
+    mOnsetsPG.resize(mNumFrames, NUM_FREQ_OUT);
+    mNotesPG.resize(mNumFrames, NUM_FREQ_OUT);
+    mContoursPG.resize(mNumFrames, NUM_FREQ_IN);
+    TRACE_COUNT("cnn", mNumFrames * mPGBytesPerFrame, 0);
+
+    mShardCQTSums.clear();
+    _transcribeShards(inAudio, num_samples, 0);
+  } catch (...) {
+    // Features model calls fail once cancelled
+    if (!mCancelled) {
+      throw;
+    }
+  }
+
+  if (mCancelled) {
+    _discardTranscription();
+    return;
+  }
+
+  _finishTranscription();
+}
+
+void BasicPitch::beginTranscription(size_t inExpectedNumSamples) {
+  assert(mStreamThreads.empty());
+
+  _prepareWorkers(mNumThreads);
+
+  // Reserved up front: growing the audio while shards are being transcribed
+  // has to wait for them.
+  mStreamAudio.clear();
+  mStreamAudio.reserve(inExpectedNumSamples);
+  mStreamNumSamples = 0;
+  mStreamedShards.clear();
+  mNumReadyShards = 0;
+  mNextStreamShard = 0;
+  mNumStreamShardsDone = 0;
+  mStreamEnded = false;
+  mStreamError = nullptr;
+
+  mNumFramesDone = 0;
+  mNumFramesExpected = inExpectedNumSamples / FFT_HOP + 1;
+
+  for (size_t i = 0; i < mNumThreads; i++) {
+    mStreamThreads.emplace_back(&BasicPitch::_runStreamWorker, this, i);
+  }
+}
+
+void BasicPitch::pushAudio(const float *inAudio, size_t inNumSamples) {
+  if (inNumSamples == 0 || mCancelled) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mStreamMutex);
+
+  if (mStreamAudio.size() + inNumSamples > mStreamAudio.capacity()) {
+    // Reallocating moves the audio read by the shards being transcribed
+    mStreamCondition.wait(
+        lock, [this] { return mNumStreamShardsDone == mNextStreamShard; });
+    mStreamAudio.reserve(std::max(mStreamAudio.size() + inNumSamples,
+                                  2 * mStreamAudio.capacity()));
+  }
+
+  mStreamAudio.insert(mStreamAudio.end(), inAudio, inAudio + inNumSamples);
+  mStreamNumSamples = mStreamAudio.size();
+
+  // A shard is ready once the audio covers its CNN lookahead and the features
+  // context after it: its CQT is then the same as on the whole signal, and its
+  // last frames are not the last ones of the signal. With a single features
+  // call, the only shard is transcribed by endTranscription.
+  const size_t num_lh_frames = BasicPitchCNN::getNumFramesLookahead();
+  const size_t num_ready_shards = mNumReadyShards;
+
+  while (!mSingleFeaturesCall &&
+         ((mNumReadyShards + 1) * mChunkNumFrames + num_lh_frames +
+          Features::mNumContextFrames) *
+                 FFT_HOP <=
+             mStreamNumSamples) {
+    mStreamedShards.push_back(std::make_unique<StreamedShard>());
+    mNumReadyShards++;
+  }
+
+  if (mNumReadyShards > num_ready_shards) {
+    lock.unlock();
+    mStreamCondition.notify_all();
+  }
+}
+
+void BasicPitch::endTranscription() {
+  {
+    std::lock_guard<std::mutex> lock(mStreamMutex);
+    mStreamEnded = true;
+  }
+  mStreamCondition.notify_all();
+
+  for (auto &thread : mStreamThreads) {
+    thread.join();
+  }
+  mStreamThreads.clear();
+
+  if (mCancelled) {
+    mStreamError = nullptr;
+    _discardTranscription();
+    return;
+  }
+
+  if (mStreamError) {
+    mStreamedShards.clear();
+    std::rethrow_exception(std::exchange(mStreamError, nullptr));
+  }
+
+  const float *audio = mStreamAudio.data();
+  const size_t num_samples = mStreamAudio.size();
+
+  // Nothing was pushed, e.g. the decoding was stopped
+  if (num_samples == 0) {
+    mStreamedShards.clear();
+    return;
+  }
+
+  try {
+    mNumFrames = _computeNumFrames(mWorkers[0]->features, audio, num_samples);
+    mNumFramesExpected = mNumFrames;
+    mOnsetsPG.resize(mNumFrames, NUM_FREQ_OUT);
+    mNotesPG.resize(mNumFrames, NUM_FREQ_OUT);
+    mContoursPG.resize(mNumFrames, NUM_FREQ_IN);
+    TRACE_COUNT("cnn", mNumFrames * mPGBytesPerFrame, 0);
+
+    // Shards transcribed during pushAudio all end before the last frames
+    const size_t num_streamed_shards = mNumReadyShards;
+    mShardCQTSums.assign(num_streamed_shards, {});
+
+    for (size_t shard = 0; shard < num_streamed_shards; shard++) {
+      const size_t begin_frame = shard * mChunkNumFrames;
+      assert(begin_frame + mChunkNumFrames < mNumFrames);
+
+      const StreamedShard &streamed = *mStreamedShards[shard];
+      std::copy_n(streamed.contours.data(), mChunkNumFrames * NUM_FREQ_IN,
+                  mContoursPG[begin_frame]);
+      std::copy_n(streamed.notes.data(), mChunkNumFrames * NUM_FREQ_OUT,
+                  mNotesPG[begin_frame]);
+      std::copy_n(streamed.onsets.data(), mChunkNumFrames * NUM_FREQ_OUT,
+                  mOnsetsPG[begin_frame]);
+      mShardCQTSums[shard] = streamed.cqtSums;
+    }
+
+    mStreamedShards.clear();
+
+    _transcribeShards(audio, num_samples, num_streamed_shards);
+  } catch (...) {
+    // Features model calls fail once cancelled
+    if (!mCancelled) {
+      throw;
+    }
+  }
+
+  if (mCancelled) {
+    _discardTranscription();
+    return;
+  }
+
+  _finishTranscription();
+}
+
+std::vector<float> BasicPitch::takeAudio() {
+  assert(mStreamThreads.empty());
+
+  std::vector<float> audio;
+  audio.swap(mStreamAudio);
+  mStreamNumSamples = 0;
+  return audio;
+}
+
+void BasicPitch::cancel() {
+  {
+    std::lock_guard<std::mutex> lock(mWorkersMutex);
+    mCancelled = true;
+
+    // Terminate the features model calls in progress
+    for (auto &worker : mWorkers) {
+      worker->features.cancel();
+    }
+  }
+
+  // Wake up the stream threads waiting for audio
+  {
+    std::lock_guard<std::mutex> lock(mStreamMutex);
+  }
+  mStreamCondition.notify_all();
+}
+
+void BasicPitch::clearCancel() {
+  std::lock_guard<std::mutex> lock(mWorkersMutex);
+  mCancelled = false;
+
+  for (auto &worker : mWorkers) {
+    worker->features.clearCancel();
+  }
+}
+
+bool BasicPitch::isCancelled() const { return mCancelled; }
+
+float BasicPitch::getProgress() const {
+  const size_t num_expected = mNumFramesExpected.load();
+  if (num_expected == 0) {
+    return 0.0f;
+  }
+
+  return std::min(static_cast<float>(mNumFramesDone.load()) /
+                      static_cast<float>(num_expected),
+                  1.0f);
+}
+
+size_t BasicPitch::_getShardNumFrames() const {
+  return mSingleFeaturesCall ? std::max<size_t>(mNumFrames, 1)
+                             : mChunkNumFrames;
+}
+
+void BasicPitch::_prepareWorkers(size_t inNumThreads) {
+  {
+    std::lock_guard<std::mutex> lock(mWorkersMutex);
+
+    while (mWorkers.size() < inNumThreads) {
+      mWorkers.push_back(std::make_unique<ShardWorker>(mFeaturesParams));
+      if (mCancelled) {
+        mWorkers.back()->features.cancel();
+      }
+    }
+  }
+
+  if (mZeroFrames.empty()) {
+    mZeroFrames.resize(BasicPitchCNN::getNumFramesLookahead() * NUM_HARMONICS *
+                           NUM_FREQ_IN,
+                       0.0f);
+  }
+}
+
+void BasicPitch::_transcribeShards(const float *inAudio, size_t inNumSamples,
+                                   size_t inFirstShard) {
+  const size_t shard_num_frames = _getShardNumFrames();
+  const size_t num_shards = std::max<size_t>(
+      (mNumFrames + shard_num_frames - 1) / shard_num_frames, 1);
+
+  mShardCQTSums.resize(num_shards);
+
+  if (inFirstShard >= num_shards) {
+    return;
+  }
+
+  const size_t num_threads = std::min(mNumThreads, num_shards - inFirstShard);
+  _prepareWorkers(num_threads);
+
+  // Each thread takes the next shard not yet transcribed. Shards write to
+  // disjoint frames of the posteriorgrams.
+  std::atomic<size_t> next_shard{inFirstShard};
+  std::vector<std::exception_ptr> errors(num_threads);
+
+  auto run_worker = [&](size_t inWorkerIdx) {
+    try {
+      for (size_t shard = next_shard++; shard < num_shards && !mCancelled;
+           shard = next_shard++) {
+        const size_t begin_frame = shard * shard_num_frames;
+        const size_t end_frame =
+            std::min(begin_frame + shard_num_frames, mNumFrames);
+        const size_t num_shard_frames = end_frame - begin_frame;
+
+        const ShardOutput output{
+            mContoursPG.getView(begin_frame, num_shard_frames),
+            mNotesPG.getView(begin_frame, num_shard_frames),
+            mOnsetsPG.getView(begin_frame, num_shard_frames),
+            &mShardCQTSums[shard]};
+
+        _transcribeShard(*mWorkers[inWorkerIdx], inAudio, inNumSamples,
+                         mNumFrames, begin_frame, end_frame, output);
+      }
+    } catch (...) {
+      errors[inWorkerIdx] = std::current_exception();
+      next_shard = num_shards;
+    }
+  };
 
-  mOnsetsPG.resize(mNumFrames,
-                   std::vector<float>(static_cast<size_t>(NUM_FREQ_OUT), 0.0f));
-  mNotesPG.resize(mNumFrames,
-                  std::vector<float>(static_cast<size_t>(NUM_FREQ_OUT), 0.0f));
-  mContoursPG.resize(
-      mNumFrames, std::vector<float>(static_cast<size_t>(NUM_FREQ_IN), 0.0f));
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(run_worker, i);
+  }
+
+  run_worker(0);
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
 
-  mOnsetsPG.shrink_to_fit();
-  mNotesPG.shrink_to_fit();
-  mContoursPG.shrink_to_fit();
+  // Errors of the features model calls terminated by cancel
+  if (mCancelled) {
+    return;
+  }
+
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+void BasicPitch::_runStreamWorker(size_t inWorkerIdx) {
+  std::unique_lock<std::mutex> lock(mStreamMutex);
+
+  while (true) {
+    mStreamCondition.wait(lock, [this] {
+      return mNextStreamShard < mNumReadyShards || mStreamEnded ||
+             mStreamError || mCancelled;
+    });
+
+    if (mStreamError || mCancelled || mNextStreamShard >= mNumReadyShards) {
+      return;
+    }
+
+    const size_t shard = mNextStreamShard++;
+    StreamedShard &streamed = *mStreamedShards[shard];
+    const float *audio = mStreamAudio.data();
+    const size_t num_samples = mStreamNumSamples;
+
+    lock.unlock();
+
+    std::exception_ptr error;
+
+    try {
+      const size_t begin_frame = shard * mChunkNumFrames;
+
+      streamed.contours.resize(mChunkNumFrames, NUM_FREQ_IN);
+      streamed.notes.resize(mChunkNumFrames, NUM_FREQ_OUT);
+      streamed.onsets.resize(mChunkNumFrames, NUM_FREQ_OUT);
+      TRACE_COUNT("cnn", mChunkNumFrames * mPGBytesPerFrame, 0);
+
+      const ShardOutput output{streamed.contours.getView(0, mChunkNumFrames),
+                               streamed.notes.getView(0, mChunkNumFrames),
+                               streamed.onsets.getView(0, mChunkNumFrames),
+                               &streamed.cqtSums};
+
+      // The signal has at least the frames of the audio available so far
+      _transcribeShard(*mWorkers[inWorkerIdx], audio, num_samples,
+                       num_samples / FFT_HOP + 1, begin_frame,
+                       begin_frame + mChunkNumFrames, output);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+
+    mNumStreamShardsDone++;
+    if (error && !mStreamError) {
+      mStreamError = error;
+    }
+
+    mStreamCondition.notify_all();
+  }
+}
+
+void BasicPitch::_finishTranscription() {
+  // Bin b is centered on semitone (b + 1) / 3 above A0
+  mChroma.fill(0.0f);
+  for (const auto &cqt_sums : mShardCQTSums) {
+    for (int bin = 0; bin < NUM_FREQ_IN; bin++) {
+      const int midi_note =
+          MIDI_OFFSET + (bin + 1) / CONTOURS_BINS_PER_SEMITONE;
+      mChroma[static_cast<size_t>(midi_note % 12)] +=
+          cqt_sums[static_cast<size_t>(bin)];
+    }
+  }
 
-  mBasicPitchCNN.reset();
+  TRACE_SCOPE(notes_scope, "notes");
+  TRACE_FRAMES(notes_scope, mNumFrames);
 
+  mNoteEvents = mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG,
+                                      mParams, true, &mCancelled);
+  TRACE_BYTES(notes_scope, mNoteEvents.capacity() * sizeof(Notes::Event));
+
+  if (mCancelled) {
+    _discardTranscription();
+    return;
+  }
+
+  mNumFramesDone = mNumFramesExpected.load();
+}
+
+void BasicPitch::_discardTranscription() {
+  mContoursPG.clear();
+  mNotesPG.clear();
+  mOnsetsPG.clear();
+  mNoteEvents.clear();
+  mShardCQTSums.clear();
+  mStreamedShards.clear();
+  mChroma.fill(0.0f);
+
+  mNumFrames = 0;
+}
+
+size_t BasicPitch::_computeNumFrames(Features &inFeatures,
+                                     const float *inAudio,
+                                     size_t inNumSamples) {
+  // Frames are centered on multiples of FFT_HOP: count the frames computed on
+  // the last few seconds of the signal only.
+  const size_t last_frame_estimate = inNumSamples / FFT_HOP;
+  const size_t probe_begin_frame =
+      last_frame_estimate > Features::mNumContextFrames
+          ? last_frame_estimate - Features::mNumContextFrames
+          : 0;
+
+  size_t num_probe_frames = 0;
+  inFeatures.computeFeatures(inAudio, inNumSamples, probe_begin_frame,
+                             std::numeric_limits<size_t>::max(),
+                             num_probe_frames);
+
+  return probe_begin_frame + num_probe_frames;
+}
+
+void BasicPitch::_transcribeShard(ShardWorker &ioWorker, const float *inAudio,
+                                  size_t inNumSamples, size_t inNumFrames,
+                                  size_t inBeginFrame, size_t inEndFrame,
+                                  const ShardOutput &inOutput) {
   const size_t num_lh_frames = BasicPitchCNN::getNumFramesLookahead();
 
-  std::vector<float> zero_stacked_cqt(NUM_HARMONICS * NUM_FREQ_IN, 0.0f);
+  // Twice the lookahead covers the past receptive field of the CNN, so
+  // outputs after the warm-up no longer depend on the reset state.
+  const size_t num_warmup_frames = std::min(inBeginFrame, 2 * num_lh_frames);
+
+  const size_t first_input_frame = inBeginFrame - num_warmup_frames;
+  const size_t end_input_frame =
+      std::min(inEndFrame + num_lh_frames, inNumFrames);
+
+  size_t num_frames = 0;
+  const float *stacked_cqt = nullptr;
+  {
+    TRACE_SCOPE(cqt_scope, "cqt");
+    TRACE_FRAMES(cqt_scope, inEndFrame - inBeginFrame);
+    stacked_cqt = ioWorker.features.computeFeatures(
+        inAudio, inNumSamples, first_input_frame, end_input_frame, num_frames);
+  }
+
+  assert(num_frames == end_input_frame - first_input_frame);
 
-  // Run the CNN with 0 input and discard output (only for num_lh_frames)
-  for (int i = 0; i < num_lh_frames; i++) {
-    mBasicPitchCNN.frameInference(zero_stacked_cqt.data(), mContoursPG[0],
-                                  mNotesPG[0], mOnsetsPG[0]);
+  // Features of the shard frames only, warm-up and lookahead frames belong to
+  // the neighbouring shards
+  inOutput.cqtSums->fill(0.0f);
+  _accumulateCQT(stacked_cqt + num_warmup_frames * NUM_HARMONICS * NUM_FREQ_IN,
+                 inEndFrame - inBeginFrame, *inOutput.cqtSums);
+
+  TRACE_SCOPE(cnn_scope, "cnn");
+  TRACE_FRAMES(cnn_scope, inEndFrame - inBeginFrame);
+
+  ioWorker.cnn.reset();
+  ioWorker.nextOutputFrame = inBeginFrame;
+  ioWorker.outputBeginFrame = inBeginFrame;
+  ioWorker.output = inOutput;
+  ioWorker.numPendingDiscards = num_warmup_frames + num_lh_frames;
+
+  // Start of the signal: run the CNN with 0 input and discard output (only
+  // for num_lh_frames)
+  if (inBeginFrame == 0) {
+    ioWorker.numPendingDiscards += num_lh_frames;
+    _runCNN(ioWorker, mZeroFrames.data(), num_lh_frames);
   }
 
-  // Run the CNN with real inputs and discard outputs (only for num_lh_frames)
-  for (size_t frame_idx = 0; frame_idx < num_lh_frames; frame_idx++) {
-    mBasicPitchCNN.frameInference(stacked_cqt +
-                                      frame_idx * NUM_HARMONICS * NUM_FREQ_IN,
-                                  mContoursPG[0], mNotesPG[0], mOnsetsPG[0]);
+  _runCNN(ioWorker, stacked_cqt, num_frames);
+
+  if (mCancelled) {
+    return;
   }
 
-  // Run the CNN with real inputs and correct outputs
-  for (size_t frame_idx = num_lh_frames; frame_idx < mNumFrames; frame_idx++) {
-    mBasicPitchCNN.frameInference(stacked_cqt +
-                                      frame_idx * NUM_HARMONICS * NUM_FREQ_IN,
-                                  mContoursPG[frame_idx - num_lh_frames],
-                                  mNotesPG[frame_idx - num_lh_frames],
-                                  mOnsetsPG[frame_idx - num_lh_frames]);
+  // End of the signal: run with zeroes as input to get last frames as output
+  if (inEndFrame + num_lh_frames > inNumFrames) {
+    _runCNN(ioWorker, mZeroFrames.data(),
+            inEndFrame + num_lh_frames - inNumFrames);
   }
 
-  // Run end with zeroes as input and last frames as output
-  for (size_t frame_idx = mNumFrames; frame_idx < mNumFrames + num_lh_frames;
-       frame_idx++) {
-    mBasicPitchCNN.frameInference(zero_stacked_cqt.data(),
-                                  mContoursPG[frame_idx - num_lh_frames],
-                                  mNotesPG[frame_idx - num_lh_frames],
-                                  mOnsetsPG[frame_idx - num_lh_frames]);
+  assert(ioWorker.nextOutputFrame == inEndFrame);
+}
+
+void BasicPitch::_accumulateCQT(const float *inStackedCQT,
+                               size_t inNumFrames,
+                               std::array<float, NUM_FREQ_IN> &ioCQTSums) {
+  for (size_t frame = 0; frame < inNumFrames; frame++) {
+    const float *cqt = inStackedCQT + frame * NUM_FREQ_IN * NUM_HARMONICS;
+    for (size_t bin = 0; bin < NUM_FREQ_IN; bin++) {
+      ioCQTSums[bin] += cqt[bin * NUM_HARMONICS + mFundamentalIdx];
+    }
+  }
+}
+
+void BasicPitch::_runCNN(ShardWorker &ioWorker, const float *inFrames,
+                         size_t inNumFrames) {
+  if (ioWorker.numPendingDiscards > 0) {
+    const size_t num_discarded =
+        std::min(inNumFrames, ioWorker.numPendingDiscards);
+
+    ioWorker.cnn.batchInference(inFrames, num_discarded, nullptr, nullptr,
+                                nullptr);
+
+    ioWorker.numPendingDiscards -= num_discarded;
+    inFrames += num_discarded * NUM_HARMONICS * NUM_FREQ_IN;
+    inNumFrames -= num_discarded;
   }
 
-  mNoteEvents =
-      mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, true);
+  const ShardOutput &output = ioWorker.output;
+
+  // In batches, with a cancellation checkpoint between them
+  while (inNumFrames > 0 && !mCancelled) {
+    const size_t num_batch_frames = std::min(inNumFrames, mCNNBatchNumFrames);
+    const size_t frame_idx =
+        ioWorker.nextOutputFrame - ioWorker.outputBeginFrame;
+    assert(frame_idx + num_batch_frames <= output.notes.numFrames);
+
+    ioWorker.cnn.batchInference(inFrames, num_batch_frames,
+                                output.contours[frame_idx],
+                                output.notes[frame_idx],
+                                output.onsets[frame_idx]);
+
+    ioWorker.nextOutputFrame += num_batch_frames;
+    inFrames += num_batch_frames * NUM_HARMONICS * NUM_FREQ_IN;
+    inNumFrames -= num_batch_frames;
+
+    mNumFramesDone += num_batch_frames;
+  }
 }
 
 void BasicPitch::updateMIDI() {
-  mNoteEvents =
-      mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, false);
+  TRACE_SCOPE(notes_scope, "notes");
+  TRACE_FRAMES(notes_scope, mNumFrames);
+
+  mNoteEvents = mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG,
+                                      mParams, false, &mCancelled);
+  TRACE_BYTES(notes_scope, mNoteEvents.capacity() * sizeof(Notes::Event));
 }
 
 const std::vector<Notes::Event> &BasicPitch::getNoteEvents() const {
   return mNoteEvents;
 }
+
+const Posteriorgram &BasicPitch::getContoursPG() const { return mContoursPG; }
+
+const Posteriorgram &BasicPitch::getNotesPG() const { return mNotesPG; }
+
+const Posteriorgram &BasicPitch::getOnsetsPG() const { return mOnsetsPG; }
+
+const std::array<float, 12> &BasicPitch::getChroma() const { return mChroma; }
@@ -5,10 +5,21 @@
 #ifndef BasicPitch_h
 #define BasicPitch_h
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "BasicPitchCNN.h"
 #include "BasicPitchConstants.h"
 #include "Features.h"
 #include "Notes.h"
+#include "Posteriorgram.h"
+#include "Trace.h"
 
 /**
  * Class to get midi transcription from raw audio.
@@ -17,9 +28,14 @@ class BasicPitch {
 public:
   BasicPitch() = default;
 
+  /**
+   * Stops the threads of a progressive transcription that was not ended.
+   */
+  ~BasicPitch();
+
   /**
    * Resets all states of model, clear the posteriorgrams vector computed by the
-   * CNN and the note event vector.
+   * CNN, the note event vector and the audio given to pushAudio.
    */
   void reset();
 
@@ -34,13 +50,97 @@ public:
   void setParameters(float inNoteSensitivity, float inSplitSensitivity,
                      float inMinNoteDurationMs);
 
+  /**
+   * Set the number of threads used by transcribeToMIDI. The signal is cut in
+   * shards of mChunkNumFrames frames that are transcribed independently, so
+   * the result does not depend on the number of threads. It is not bit-exact
+   * with a single pass on the whole signal though: the features of each
+   * shard are normalized on their own (see setSingleFeaturesCall).
+   * @param inNumThreads Number of threads (at least 1)
+   */
+  void setNumThreads(size_t inNumThreads);
+
+  /**
+   * Compute the features of the whole signal in a single model call, as
+   * before features were computed in chunks, instead of one call per shard.
+   * The model normalizes its log CQT by the min and max over each call, so
+   * chunked features, and so the posteriorgrams, drift slightly from a single
+   * call on signals longer than a shard. A single call is the reference that
+   * drift is measured against (Sample2MIDI_Golden --compare-full). Its memory
+   * grows with the length of the signal and it runs on one thread.
+   * @param inSingleCall True for a single features call
+   */
+  void setSingleFeaturesCall(bool inSingleCall);
+
+  /**
+   * Set the ONNX Runtime session parameters of the features model. Sessions
+   * already created are recreated on next transcription.
+   * @param inParams Session parameters
+   */
+  void setFeaturesSessionParams(const Features::SessionParams &inParams);
+
   /**
    * Transcribe the input audio. The note event vector can be obtained after
    * this with getNoteEvents
    * @param inAudio Pointer to raw audio (must be at 22050 Hz)
    * @param inNumSamples Number of input samples available.
    */
-  void transcribeToMIDI(float *inAudio, int inNumSamples);
+  void transcribeToMIDI(const float *inAudio, int inNumSamples);
+
+  /**
+   * Start a transcription of audio given progressively with pushAudio, e.g.
+   * while it is being decoded. Shards are transcribed on mNumThreads threads
+   * as soon as their audio, CNN lookahead and features context are available,
+   * and the result is the same as with transcribeToMIDI on the whole audio.
+   * @param inExpectedNumSamples Expected number of samples (22050 Hz), to
+   * reserve memory. The audio can end up longer or shorter.
+   */
+  void beginTranscription(size_t inExpectedNumSamples);
+
+  /**
+   * Append audio to the transcription started with beginTranscription.
+   * @param inAudio Pointer to raw audio (must be at 22050 Hz)
+   * @param inNumSamples Number of samples in inAudio
+   */
+  void pushAudio(const float *inAudio, size_t inNumSamples);
+
+  /**
+   * End of the audio given to pushAudio: transcribe the remaining shards. The
+   * note event vector can be obtained after this with getNoteEvents
+   */
+  void endTranscription();
+
+  /**
+   * Move out the audio given to pushAudio since beginTranscription, e.g. to
+   * transcribe it again with transcribeToMIDI without converting it again.
+   * @return Audio at 22050 Hz. Empty if already taken.
+   */
+  std::vector<float> takeAudio();
+
+  /**
+   * Cancel the running transcription. Can be called from any thread. The
+   * transcription stops at its next checkpoint (CNN batch, features model
+   * call, notes conversion) and leaves no note events, as do the following
+   * ones until clearCancel is called.
+   */
+  void cancel();
+
+  /**
+   * Allow transcriptions again after cancel.
+   */
+  void clearCancel();
+
+  /**
+   * @return True if cancel was called since the last clearCancel.
+   */
+  bool isCancelled() const;
+
+  /**
+   * Progress of the running or last transcription. Can be polled from any
+   * thread.
+   * @return Fraction of the frames transcribed, in [0, 1].
+   */
+  float getProgress() const;
 
   /**
    * Function to call to update the midi transcription with new parameters.
@@ -53,20 +153,232 @@ public:
    */
   const std::vector<Notes::Event> &getNoteEvents() const;
 
+  /**
+   * Posteriorgrams of the last transcription, e.g. to compare transcriptions.
+   * Empty if nothing was transcribed.
+   * @return Contour posteriorgrams (frames x 264)
+   */
+  const Posteriorgram &getContoursPG() const;
+
+  /**
+   * @return Note posteriorgrams of the last transcription (frames x 88)
+   */
+  const Posteriorgram &getNotesPG() const;
+
+  /**
+   * @return Onset posteriorgrams of the last transcription (frames x 88)
+   */
+  const Posteriorgram &getOnsetsPG() const;
+
+  /**
+   * Pitch class profile of the last transcription, for key detection. The
+   * fundamental plane of the CQT features (3 bins per semitone from A0) is
+   * summed over all frames and folded into 12 pitch classes, C first.
+   * @return Pitch class profile. All zeros if nothing was transcribed.
+   */
+  const std::array<float, 12> &getChroma() const;
+
 private:
-  // Posteriorgrams vector
-  std::vector<std::vector<float>> mContoursPG;
-  std::vector<std::vector<float>> mNotesPG;
-  std::vector<std::vector<float>> mOnsetsPG;
+  /**
+   * Posteriorgram frames and CQT sums a shard is written to. Frame 0 of the
+   * views is the first frame of the shard.
+   */
+  struct ShardOutput {
+    PosteriorgramView<float> contours;
+    PosteriorgramView<float> notes;
+    PosteriorgramView<float> onsets;
+    std::array<float, NUM_FREQ_IN> *cqtSums = nullptr;
+  };
+
+  /**
+   * Shard transcribed by beginTranscription / pushAudio, before the total
+   * number of frames and so the size of the posteriorgrams are known.
+   */
+  struct StreamedShard {
+    Posteriorgram contours;
+    Posteriorgram notes;
+    Posteriorgram onsets;
+    std::array<float, NUM_FREQ_IN> cqtSums{};
+  };
+
+  /**
+   * Features calculator and CNN used to transcribe one shard at a time.
+   * Each thread owns one, the CNN being stateful.
+   */
+  struct ShardWorker {
+    explicit ShardWorker(const Features::SessionParams &inParams)
+        : features(inParams) {}
+
+    Features features;
+    BasicPitchCNN cnn;
+
+    // Number of upcoming CNN outputs to discard (warm-up)
+    size_t numPendingDiscards = 0;
+    // Posteriorgram frame the next kept CNN output is written to
+    size_t nextOutputFrame = 0;
+    // First frame and destination of the shard being transcribed
+    size_t outputBeginFrame = 0;
+    ShardOutput output;
+  };
+
+  /**
+   * @return Number of frames of a shard: mChunkNumFrames, or all frames of the
+   * signal with a single features call.
+   */
+  size_t _getShardNumFrames() const;
+
+  /**
+   * Create workers and buffers for inNumThreads threads.
+   * @param inNumThreads Number of threads
+   */
+  void _prepareWorkers(size_t inNumThreads);
+
+  /**
+   * Transcribe shards [inFirstShard, num shards) of a signal of mNumFrames
+   * frames into the posteriorgrams, on up to mNumThreads threads.
+   * @param inAudio Pointer to raw audio
+   * @param inNumSamples Number of input samples available.
+   * @param inFirstShard First shard to transcribe
+   */
+  void _transcribeShards(const float *inAudio, size_t inNumSamples,
+                         size_t inFirstShard);
+
+  /**
+   * Thread function of a progressive transcription: transcribe the shards
+   * made available by pushAudio until endTranscription.
+   * @param inWorkerIdx Index of the worker owned by the thread
+   */
+  void _runStreamWorker(size_t inWorkerIdx);
+
+  /**
+   * Fold mShardCQTSums into mChroma and convert the posteriorgrams to notes.
+   */
+  void _finishTranscription();
+
+  /**
+   * Clear the posteriorgrams, notes and chroma of a cancelled transcription.
+   */
+  void _discardTranscription();
+
+  /**
+   * Run the features model on the end of the signal only to get its total
+   * number of frames.
+   * @param inFeatures Features calculator to use
+   * @param inAudio Pointer to raw audio
+   * @param inNumSamples Number of input samples available.
+   * @return Number of frames of the full signal.
+   */
+  static size_t _computeNumFrames(Features &inFeatures, const float *inAudio,
+                                  size_t inNumSamples);
+
+  /**
+   * Compute features and run the CNN to fill frames [inBeginFrame, inEndFrame)
+   * of the posteriorgrams. The CNN is first warmed up on the frames preceding
+   * inBeginFrame, covering its whole receptive field, so a shard gives the same
+   * output whatever worker runs it.
+   * @param ioWorker Worker to use
+   * @param inAudio Pointer to raw audio
+   * @param inNumSamples Number of input samples available. Only a prefix of
+   * the signal is needed if it covers the features context after the shard.
+   * @param inNumFrames Number of frames of the signal, or any number of frames
+   * at least inEndFrame + CNN lookahead if the signal continues after that.
+   * @param inBeginFrame First frame of the shard
+   * @param inEndFrame Frame after the last one of the shard
+   * @param inOutput Destination of the shard frames and of the sum over them
+   * of the fundamental CQT bins
+   */
+  void _transcribeShard(ShardWorker &ioWorker, const float *inAudio,
+                        size_t inNumSamples, size_t inNumFrames,
+                        size_t inBeginFrame, size_t inEndFrame,
+                        const ShardOutput &inOutput);
+
+  /**
+   * Add the fundamental plane of stacked CQT frames to per bin sums.
+   * @param inStackedCQT Stacked CQT frames, inNumFrames * 264 * 8 elements
+   * @param inNumFrames Number of frames in inStackedCQT
+   * @param ioCQTSums Per bin sums
+   */
+  static void _accumulateCQT(const float *inStackedCQT, size_t inNumFrames,
+                             std::array<float, NUM_FREQ_IN> &ioCQTSums);
+
+  /**
+   * Run the CNN of a worker on consecutive input frames and write outputs in
+   * the shard output of the worker, discarding the first
+   * ioWorker.numPendingDiscards ones.
+   * Outputs lag the CNN lookahead behind the inputs.
+   * @param ioWorker Worker to use
+   * @param inFrames Stacked CQT frames, inNumFrames * 8 * 264 elements
+   * @param inNumFrames Number of frames in inFrames
+   */
+  void _runCNN(ShardWorker &ioWorker, const float *inFrames,
+               size_t inNumFrames);
+
+  // Posteriorgrams (frames x bins)
+  Posteriorgram mContoursPG;
+  Posteriorgram mNotesPG;
+  Posteriorgram mOnsetsPG;
+
+  // Size of a frame of the three posteriorgrams, for tracing
+  static constexpr size_t mPGBytesPerFrame =
+      (NUM_FREQ_IN + 2 * NUM_FREQ_OUT) * sizeof(float);
 
   std::vector<Notes::Event> mNoteEvents;
 
+  // Per shard sums of the fundamental CQT bins, folded into mChroma in shard
+  // order so that the result does not depend on the number of threads.
+  std::vector<std::array<float, NUM_FREQ_IN>> mShardCQTSums;
+  std::array<float, 12> mChroma{};
+
+  // Index of harmonic 1 in the stacked features (harmonics 0.5, 1, 2, ..., 7)
+  static constexpr size_t mFundamentalIdx = 1;
+
   Notes::ConvertParams mParams;
 
   size_t mNumFrames = 0;
 
-  Features mFeaturesCalculator;
-  BasicPitchCNN mBasicPitchCNN;
+  // Number of frames per shard (~24 s of audio)
+  static constexpr size_t mChunkNumFrames = 2048;
+
+  // Whole signal in one shard and one features call, see
+  // setSingleFeaturesCall
+  bool mSingleFeaturesCall = false;
+
+  // Number of CNN frames run between two cancellation checkpoints
+  static constexpr size_t mCNNBatchNumFrames = 256;
+
+  std::atomic<bool> mCancelled{false};
+
+  // Frames transcribed and expected, for getProgress
+  std::atomic<size_t> mNumFramesDone{0};
+  std::atomic<size_t> mNumFramesExpected{0};
+
+  size_t mNumThreads = 1;
+
+  Features::SessionParams mFeaturesParams;
+
+  // Silent input frames, for CNN warm-up and lookahead at signal boundaries
+  std::vector<float> mZeroFrames;
+
+  // Created on demand, one per thread. Guarded by mWorkersMutex when resized,
+  // as cancel reaches the workers from another thread.
+  std::vector<std::unique_ptr<ShardWorker>> mWorkers;
+  std::mutex mWorkersMutex;
+
+  // Progressive transcription. Stream threads read mStreamAudio up to
+  // mStreamNumSamples without locking: it is only reallocated when no shard is
+  // being transcribed. Other members are guarded by mStreamMutex.
+  std::vector<float> mStreamAudio;
+  size_t mStreamNumSamples = 0;
+  std::vector<std::unique_ptr<StreamedShard>> mStreamedShards;
+  size_t mNumReadyShards = 0; // Shards whose inputs are all available
+  size_t mNextStreamShard = 0; // Next shard taken by a stream thread
+  size_t mNumStreamShardsDone = 0;
+  bool mStreamEnded = false;
+  std::exception_ptr mStreamError;
+  std::mutex mStreamMutex;
+  std::condition_variable mStreamCondition;
+  std::vector<std::thread> mStreamThreads;
+
   Notes mNotesCreator;
 };
 
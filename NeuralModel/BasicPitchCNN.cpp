@@ -4,35 +4,206 @@
 
 #include "BasicPitchCNN.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
 using json = nlohmann::json;
 
-BasicPitchCNN::BasicPitchCNN() {
-  json json_cnn_contour =
-      json::parse(BinaryData::cnn_contour_model_json,
-                  BinaryData::cnn_contour_model_json +
-                      BinaryData::cnn_contour_model_jsonSize);
+namespace {
+
+// Weights of a conv2d layer as given to RTNeural::Conv2DT
+struct Conv2DWeights {
+  std::vector<std::vector<std::vector<std::vector<float>>>> weights;
+  std::vector<float> bias;
+};
+
+// Conv2d layers of the four models, in the order of the BinaryData files.
+struct CNNWeights {
+  enum Model { Contour = 0, Note, OnsetInput, OnsetOutput, NumModels };
+
+  std::array<std::vector<Conv2DWeights>, NumModels> models;
+};
+
+#if BASIC_PITCH_CNN_WEIGHTS_BINARY
+
+/**
+ * Read weights generated at build time by Tools/ConvertCNNWeights.cpp from
+ * the JSON models (format documented there). Throws std::runtime_error if the
+ * data does not follow the format, e.g. a stale weights file, as parsing the
+ * JSON models does on invalid JSON.
+ */
+CNNWeights readBinaryWeights(const char *inData, size_t inSize) {
+  size_t pos = 0;
+
+  auto check = [](bool inCondition, const char *inWhat) {
+    if (!inCondition) {
+      throw std::runtime_error(std::string("Invalid CNN weights: ") + inWhat);
+    }
+  };
+
+  auto read = [&](void *outDest, size_t inNumBytes) {
+    check(inNumBytes <= inSize - pos, "truncated data");
+    std::memcpy(outDest, inData + pos, inNumBytes);
+    pos += inNumBytes;
+  };
+
+  auto read_u32 = [&]() {
+    uint32_t value = 0;
+    read(&value, sizeof(value));
+    return value;
+  };
+
+  char magic[4];
+  read(magic, sizeof(magic));
+  check(std::memcmp(magic, "BPCW", 4) == 0, "bad magic");
+
+  const uint32_t version = read_u32();
+  const uint32_t num_models = read_u32();
+  check(version == 1, "unsupported version");
+  check(num_models == CNNWeights::NumModels, "unexpected number of models");
+
+  CNNWeights cnn_weights;
+
+  // Kernel sizes and numbers of filters preceding the values of a layer
+  constexpr size_t layer_header_size = 4 * sizeof(uint32_t);
+
+  for (auto &layers : cnn_weights.models) {
+    const uint32_t num_layers = read_u32();
+    check(num_layers <= (inSize - pos) / layer_header_size,
+          "truncated model");
+    layers.resize(num_layers);
+
+    for (auto &layer : layers) {
+      const uint32_t kernel_size_time = read_u32();
+      const uint32_t kernel_size_feature = read_u32();
+      const uint32_t num_filters_in = read_u32();
+      const uint32_t num_filters_out = read_u32();
+
+      // Checked before allocating, so that garbage sizes fail here
+      const size_t max_values = (inSize - pos) / sizeof(float);
+      check(num_filters_out <= max_values, "truncated layer");
+      size_t num_weights = num_filters_out;
+      for (const uint32_t size :
+           {kernel_size_time, kernel_size_feature, num_filters_in}) {
+        check(size == 0 || num_weights <= max_values / size,
+              "truncated layer");
+        num_weights *= size;
+      }
+      check(num_weights <= max_values - num_filters_out, "truncated layer");
+
+      layer.weights.resize(kernel_size_time);
+
+      for (auto &time : layer.weights) {
+        time.resize(kernel_size_feature);
+
+        for (auto &feature : time) {
+          feature.resize(num_filters_in);
+
+          for (auto &filter_in : feature) {
+            filter_in.resize(num_filters_out);
+            read(filter_in.data(), num_filters_out * sizeof(float));
+          }
+        }
+      }
+
+      layer.bias.resize(num_filters_out);
+      read(layer.bias.data(), num_filters_out * sizeof(float));
+    }
+  }
+
+  check(pos == inSize, "trailing data");
+
+  return cnn_weights;
+}
+
+CNNWeights loadWeights() {
+  return readBinaryWeights(
+      BinaryData::cnn_weights_bin,
+      static_cast<size_t>(BinaryData::cnn_weights_binSize));
+}
 
-  mCNNContour.parseJson(json_cnn_contour);
+#else
 
-  json json_cnn_note = json::parse(BinaryData::cnn_note_model_json,
-                                   BinaryData::cnn_note_model_json +
-                                       BinaryData::cnn_note_model_jsonSize);
+std::vector<Conv2DWeights> parseJsonWeights(const char *inData, int inSize) {
+  json model = json::parse(inData, inData + inSize);
 
-  mCNNNote.parseJson(json_cnn_note);
+  std::vector<Conv2DWeights> layers;
 
-  json json_cnn_onset_input =
-      json::parse(BinaryData::cnn_onset_1_model_json,
-                  BinaryData::cnn_onset_1_model_json +
-                      BinaryData::cnn_onset_1_model_jsonSize);
+  for (const auto &layer : model.at("layers")) {
+    if (layer.at("type") == "conv2d") {
+      Conv2DWeights conv;
+      layer.at("weights").at(0).get_to(conv.weights);
+      layer.at("weights").at(1).get_to(conv.bias);
+      layers.push_back(std::move(conv));
+    }
+  }
 
-  mCNNOnsetInput.parseJson(json_cnn_onset_input);
+  return layers;
+}
 
-  json json_cnn_onset_output =
-      json::parse(BinaryData::cnn_onset_2_model_json,
-                  BinaryData::cnn_onset_2_model_json +
-                      BinaryData::cnn_onset_2_model_jsonSize);
+CNNWeights loadWeights() {
+  CNNWeights cnn_weights;
+
+  cnn_weights.models[CNNWeights::Contour] =
+      parseJsonWeights(BinaryData::cnn_contour_model_json,
+                       BinaryData::cnn_contour_model_jsonSize);
+  cnn_weights.models[CNNWeights::Note] = parseJsonWeights(
+      BinaryData::cnn_note_model_json, BinaryData::cnn_note_model_jsonSize);
+  cnn_weights.models[CNNWeights::OnsetInput] =
+      parseJsonWeights(BinaryData::cnn_onset_1_model_json,
+                       BinaryData::cnn_onset_1_model_jsonSize);
+  cnn_weights.models[CNNWeights::OnsetOutput] =
+      parseJsonWeights(BinaryData::cnn_onset_2_model_json,
+                       BinaryData::cnn_onset_2_model_jsonSize);
+
+  return cnn_weights;
+}
+
+#endif
+
+/**
+ * Weights are loaded once per process and shared by all instances.
+ */
+const CNNWeights &getWeights() {
+  static const CNNWeights cnn_weights = loadWeights();
+  return cnn_weights;
+}
 
-  mCNNOnsetOutput.parseJson(json_cnn_onset_output);
+template <typename Conv2DType>
+void setConv2DWeights(Conv2DType &outConv, const Conv2DWeights &inWeights) {
+  outConv.setWeights(inWeights.weights);
+  outConv.setBias(inWeights.bias);
+}
+
+} // namespace
+
+BasicPitchCNN::BasicPitchCNN() {
+  const auto &cnn_weights = getWeights();
+
+  const auto &contour = cnn_weights.models[CNNWeights::Contour];
+  const auto &note = cnn_weights.models[CNNWeights::Note];
+  const auto &onset_input = cnn_weights.models[CNNWeights::OnsetInput];
+  const auto &onset_output = cnn_weights.models[CNNWeights::OnsetOutput];
+
+  if (contour.size() != 2 || note.size() != 2 || onset_input.size() != 1 ||
+      onset_output.size() != 1) {
+    throw std::runtime_error("Invalid CNN weights: unexpected number of "
+                             "conv2d layers");
+  }
+
+  // Layers 1 and 3 are activations
+  setConv2DWeights(mCNNContour.get<0>(), contour[0]);
+  setConv2DWeights(mCNNContour.get<2>(), contour[1]);
+
+  setConv2DWeights(mCNNNote.get<0>(), note[0]);
+  setConv2DWeights(mCNNNote.get<2>(), note[1]);
+
+  setConv2DWeights(mCNNOnsetInput.get<0>(), onset_input[0]);
+
+  setConv2DWeights(mCNNOnsetOutput.get<0>(), onset_output[0]);
 }
 
 void BasicPitchCNN::reset() {
@@ -101,6 +272,21 @@ void BasicPitchCNN::frameInference(const float *inData,
   mConcat2Idx = (mConcat2Idx == mNumConcat2Stored - 1) ? 0 : mConcat2Idx + 1;
 }
 
+void BasicPitchCNN::batchInference(const float *inFrames, size_t inNumFrames,
+                                   float *outContours, float *outNotes,
+                                   float *outOnsets) {
+  for (size_t start = 0; start < inNumFrames; start += mBatchSize) {
+    const auto num_frames = static_cast<int>(
+        std::min(static_cast<size_t>(mBatchSize), inNumFrames - start));
+
+    _runModelsBatch(
+        inFrames + start * NUM_HARMONICS * NUM_FREQ_IN, num_frames,
+        outContours != nullptr ? outContours + start * NUM_FREQ_IN : nullptr,
+        outNotes != nullptr ? outNotes + start * NUM_FREQ_OUT : nullptr,
+        outOnsets != nullptr ? outOnsets + start * NUM_FREQ_OUT : nullptr);
+  }
+}
+
 void BasicPitchCNN::_runModels() {
   // Run models and push results in appropriate circular buffer
   mCNNOnsetInput.forward(mInputArray.data());
@@ -142,3 +328,124 @@ void BasicPitchCNN::_concat() {
               mConcatArray.begin() + i * 33 + 1);
   }
 }
+
+void BasicPitchCNN::_runModelsBatch(const float *inFrames, int inNumFrames,
+                                    float *outContours, float *outNotes,
+                                    float *outOnsets) {
+  assert(inNumFrames > 0 && inNumFrames <= mBatchSize);
+
+  // Restore history rows from circular buffers, oldest first. Slot at index
+  // + 1 is the oldest one and is read by the next frameInference call.
+  for (int h = 0; h < mNumContourHistory; h++) {
+    const auto &stored = mContoursCircularBuffer[(size_t)_wrapIndex(
+        mContourIdx + 1 + h, mNumContourStored)];
+    std::copy(stored.begin(), stored.end(),
+              mContoursBatch.begin() + h * NUM_FREQ_IN);
+  }
+
+  for (int h = 0; h < mNumNoteHistory; h++) {
+    const auto &stored = mNotesCircularBuffer[(size_t)_wrapIndex(
+        mNoteIdx + 1 + h, mNumNoteStored)];
+    std::copy(stored.begin(), stored.end(),
+              mNotesBatch.begin() + h * NUM_FREQ_OUT);
+  }
+
+  for (int h = 0; h < mNumConcat2History; h++) {
+    const auto &stored = mConcat2CircularBuffer[(size_t)_wrapIndex(
+        mConcat2Idx + 1 + h, mNumConcat2Stored)];
+    std::copy(stored.begin(), stored.end(),
+              mConcat2Batch.begin() + h * 32 * NUM_FREQ_OUT);
+  }
+
+  // Run each model over the whole block
+  for (int i = 0; i < inNumFrames; i++) {
+    mCNNContour.forward(
+        _alignedInput(inFrames + i * NUM_HARMONICS * NUM_FREQ_IN));
+    std::copy(mCNNContour.getOutputs(), mCNNContour.getOutputs() + NUM_FREQ_IN,
+              mContoursBatch.begin() + (mNumContourHistory + i) * NUM_FREQ_IN);
+  }
+
+  for (int i = 0; i < inNumFrames; i++) {
+    mCNNNote.forward(mContoursBatch.data() +
+                     (mNumContourHistory + i) * NUM_FREQ_IN);
+    std::copy(mCNNNote.getOutputs(), mCNNNote.getOutputs() + NUM_FREQ_OUT,
+              mNotesBatch.begin() + (mNumNoteHistory + i) * NUM_FREQ_OUT);
+  }
+
+  for (int i = 0; i < inNumFrames; i++) {
+    mCNNOnsetInput.forward(
+        _alignedInput(inFrames + i * NUM_HARMONICS * NUM_FREQ_IN));
+    std::copy(mCNNOnsetInput.getOutputs(),
+              mCNNOnsetInput.getOutputs() + 32 * NUM_FREQ_OUT,
+              mConcat2Batch.begin() +
+                  (mNumConcat2History + i) * 32 * NUM_FREQ_OUT);
+  }
+
+  for (int i = 0; i < inNumFrames; i++) {
+    // Concat operation with correct frame shift: row i of the concat2 block is
+    // mNumConcat2History frames behind the current one.
+    const float *notes =
+        mNotesBatch.data() + (mNumNoteHistory + i) * NUM_FREQ_OUT;
+    const float *concat2 = mConcat2Batch.data() + i * 32 * NUM_FREQ_OUT;
+
+    for (size_t j = 0; j < NUM_FREQ_OUT; j++) {
+      mConcatArray[j * 33] = notes[j];
+      std::copy(concat2 + j * 32, concat2 + (j + 1) * 32,
+                mConcatArray.begin() + j * 33 + 1);
+    }
+
+    mCNNOnsetOutput.forward(mConcatArray.data());
+
+    // Fill outputs, with the same delays as the circular buffers
+    if (outOnsets != nullptr) {
+      std::copy(mCNNOnsetOutput.getOutputs(),
+                mCNNOnsetOutput.getOutputs() + NUM_FREQ_OUT,
+                outOnsets + i * NUM_FREQ_OUT);
+    }
+
+    if (outNotes != nullptr) {
+      std::copy(mNotesBatch.begin() + i * NUM_FREQ_OUT,
+                mNotesBatch.begin() + (i + 1) * NUM_FREQ_OUT,
+                outNotes + i * NUM_FREQ_OUT);
+    }
+
+    if (outContours != nullptr) {
+      std::copy(mContoursBatch.begin() + i * NUM_FREQ_IN,
+                mContoursBatch.begin() + (i + 1) * NUM_FREQ_IN,
+                outContours + i * NUM_FREQ_IN);
+    }
+  }
+
+  // Save the last rows back as history. Indices are left untouched so the
+  // next call (batch or frame) reads them in the same order.
+  for (int h = 0; h < mNumContourHistory; h++) {
+    auto &stored = mContoursCircularBuffer[(size_t)_wrapIndex(
+        mContourIdx + 1 + h, mNumContourStored)];
+    auto row = mContoursBatch.begin() + (inNumFrames + h) * NUM_FREQ_IN;
+    std::copy(row, row + NUM_FREQ_IN, stored.begin());
+  }
+
+  for (int h = 0; h < mNumNoteHistory; h++) {
+    auto &stored = mNotesCircularBuffer[(size_t)_wrapIndex(mNoteIdx + 1 + h,
+                                                           mNumNoteStored)];
+    auto row = mNotesBatch.begin() + (inNumFrames + h) * NUM_FREQ_OUT;
+    std::copy(row, row + NUM_FREQ_OUT, stored.begin());
+  }
+
+  for (int h = 0; h < mNumConcat2History; h++) {
+    auto &stored = mConcat2CircularBuffer[(size_t)_wrapIndex(
+        mConcat2Idx + 1 + h, mNumConcat2Stored)];
+    auto row = mConcat2Batch.begin() + (inNumFrames + h) * 32 * NUM_FREQ_OUT;
+    std::copy(row, row + 32 * NUM_FREQ_OUT, stored.begin());
+  }
+}
+
+const float *BasicPitchCNN::_alignedInput(const float *inFrame) {
+  if (reinterpret_cast<uintptr_t>(inFrame) % RTNEURAL_DEFAULT_ALIGNMENT == 0) {
+    return inFrame;
+  }
+
+  std::copy(inFrame, inFrame + NUM_HARMONICS * NUM_FREQ_IN,
+            mInputArray.begin());
+  return mInputArray.data();
+}
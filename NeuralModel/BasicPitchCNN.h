@@ -44,6 +44,24 @@ public:
                       std::vector<float> &outNotes,
                       std::vector<float> &outOnsets);
 
+  /**
+   * Run inference for consecutive frames. Gives the same outputs as calling
+   * frameInference once per frame, but each model is run over a block of frames
+   * before the next one so its weights and state stay hot in cache, and results
+   * are written straight to contiguous output arrays. Calls to frameInference
+   * and batchInference can be interleaved.
+   * @param inFrames input features, inNumFrames * 8 * 264 elements.
+   * @param inNumFrames Number of frames in inFrames.
+   * @param outContours output for contour posteriorgrams, inNumFrames * 264
+   * elements. Can be nullptr to discard.
+   * @param outNotes output for note posteriorgrams, inNumFrames * 88 elements.
+   * Can be nullptr to discard.
+   * @param outOnsets output for onset posteriorgrams, inNumFrames * 88
+   * elements. Can be nullptr to discard.
+   */
+  void batchInference(const float *inFrames, size_t inNumFrames,
+                      float *outContours, float *outNotes, float *outOnsets);
+
 private:
   /**
    * Run different sequential models with correct time offset ...
@@ -55,6 +73,21 @@ private:
    */
   void _concat();
 
+  /**
+   * Run a block of at most mBatchSize frames stage by stage: each model runs
+   * over the whole block before the next one. History from the circular buffers
+   * is restored before and saved back after so that the streaming state stays
+   * identical to frame by frame inference.
+   */
+  void _runModelsBatch(const float *inFrames, int inNumFrames,
+                       float *outContours, float *outNotes, float *outOnsets);
+
+  /**
+   * Return a pointer to the frame usable as model input. RTNeural needs aligned
+   * inputs: if inFrame is not aligned it is copied in mInputArray.
+   */
+  const float *_alignedInput(const float *inFrame);
+
   /**
    * Return in-range index for given size as if periodic.
    * @param inIndex maybe out of range index
@@ -90,6 +123,26 @@ private:
   std::array<std::array<float, 32 * NUM_FREQ_OUT>, mNumConcat2Stored>
       mConcat2CircularBuffer{};
 
+  // Number of frames run per model before switching to the next one in
+  // batchInference.
+  static constexpr int mBatchSize = 16;
+
+  static constexpr int mNumContourHistory = mNumContourStored - 1;
+  static constexpr int mNumNoteHistory = mNumNoteStored - 1;
+  static constexpr int mNumConcat2History = mNumConcat2Stored - 1;
+
+  // Block outputs of each model, preceded by the history rows needed from
+  // previous frames (oldest first).
+  alignas(RTNEURAL_DEFAULT_ALIGNMENT)
+      std::array<float, (mNumContourHistory + mBatchSize) * NUM_FREQ_IN>
+          mContoursBatch{};
+  alignas(RTNEURAL_DEFAULT_ALIGNMENT)
+      std::array<float, (mNumNoteHistory + mBatchSize) * NUM_FREQ_OUT>
+          mNotesBatch{};
+  alignas(RTNEURAL_DEFAULT_ALIGNMENT)
+      std::array<float, (mNumConcat2History + mBatchSize) * 32 * NUM_FREQ_OUT>
+          mConcat2Batch{};
+
   int mContourIdx = 0;
   int mNoteIdx = 0;
   int mConcat2Idx = 0;
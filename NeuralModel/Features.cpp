@@ -4,37 +4,369 @@
 
 #include "Features.h"
 
-Features::Features() : mMemoryInfo(nullptr), mSession(nullptr) {
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <tuple>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+// Frames are centered on multiples of FFT_HOP, the signal being padded on both
+// sides.
+size_t expectedNumFrames(size_t inNumSamples) {
+  return inNumSamples / FFT_HOP + 1;
+}
+
+uint64_t fnv1a(const void *inData, size_t inSize, uint64_t inHash) {
+  const auto *bytes = static_cast<const unsigned char *>(inData);
+  for (size_t i = 0; i < inSize; i++) {
+    inHash = (inHash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return inHash;
+}
+
+/**
+ * @return Architecture and, on x86, CPUID vendor, family and feature flags
+ * of the CPU: a model optimized with ORT_ENABLE_ALL can use layouts and
+ * kernels specific to the instruction sets it was optimized on.
+ */
+std::string cpuSignature() {
+#if defined(__x86_64__) || defined(_M_X64)
+  std::string signature = "x86_64";
+#elif defined(__i386__) || defined(_M_IX86)
+  std::string signature = "x86";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  std::string signature = "arm64";
+#elif defined(__arm__) || defined(_M_ARM)
+  std::string signature = "arm";
+#else
+  std::string signature = "unknown";
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+  auto cpuid = [](unsigned int in_leaf, unsigned int in_subleaf,
+                  unsigned int (&out_regs)[4]) {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuidex(regs, static_cast<int>(in_leaf), static_cast<int>(in_subleaf));
+    for (int i = 0; i < 4; i++) {
+      out_regs[i] = static_cast<unsigned int>(regs[i]);
+    }
+#else
+    __cpuid_count(in_leaf, in_subleaf, out_regs[0], out_regs[1], out_regs[2],
+                  out_regs[3]);
+#endif
+  };
+
+  unsigned int regs[4];
+  char buffer[64];
+
+  // Vendor (ebx, edx, ecx) and highest leaf
+  cpuid(0, 0, regs);
+  const unsigned int max_leaf = regs[0];
+  std::snprintf(buffer, sizeof(buffer), "-%08x%08x%08x", regs[1], regs[3],
+                regs[2]);
+  signature += buffer;
+
+  // Family, model and feature flags. Leaf 1 ebx holds the id of the calling
+  // core, so it is left out.
+  if (max_leaf >= 1) {
+    cpuid(1, 0, regs);
+    std::snprintf(buffer, sizeof(buffer), "-%08x%08x%08x", regs[0], regs[2],
+                  regs[3]);
+    signature += buffer;
+  }
+
+  // Extended feature flags (AVX2, AVX-512, VNNI...)
+  if (max_leaf >= 7) {
+    cpuid(7, 0, regs);
+    std::snprintf(buffer, sizeof(buffer), "-%08x%08x%08x", regs[1], regs[2],
+                  regs[3]);
+    signature += buffer;
+  }
+#endif
+
+  return signature;
+}
+
+bool readFile(const std::filesystem::path &inPath, std::vector<char> &outData) {
+  std::ifstream file(inPath, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+
+  const auto size = static_cast<std::streamoff>(file.tellg());
+  if (size <= 0) {
+    return false;
+  }
+
+  outData.resize(static_cast<size_t>(size));
+  file.seekg(0);
+  return static_cast<bool>(
+      file.read(outData.data(), static_cast<std::streamsize>(size)));
+}
+
+} // namespace
+
+Features::Features() : Features(SessionParams()) {}
+
+Features::Features(const SessionParams &inParams)
+    : mMemoryInfo(nullptr), mIoBinding(nullptr) {
   mMemoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
 
-  mSessionOptions.SetInterOpNumThreads(1);
-  mSessionOptions.SetIntraOpNumThreads(1);
+  mSession = _getSharedSession(inParams);
+  mIoBinding = Ort::IoBinding(*mSession);
+}
+
+Ort::Env &Features::_getEnv() {
+  static Ort::Env env;
+  return env;
+}
+
+std::shared_ptr<Ort::Session>
+Features::_getSharedSession(const SessionParams &inParams) {
+  using Key = std::tuple<int, int, std::filesystem::path>;
+
+  static std::mutex mutex;
+  static std::map<Key, std::weak_ptr<Ort::Session>> sessions;
+
+  const Key key{std::max(inParams.numIntraOpThreads, 1),
+                static_cast<int>(inParams.graphOptimizationLevel),
+                inParams.optimizedModelCacheDir};
+
+  // Held while creating the session so that concurrent instances wait for
+  // it instead of loading the model again
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto &entry = sessions[key];
+  auto session = entry.lock();
+
+  if (session == nullptr) {
+    session = std::make_shared<Ort::Session>(_createSession(inParams));
+    entry = session;
+  }
+
+  return session;
+}
+
+Ort::Session Features::_createSession(const SessionParams &inParams) {
+  namespace fs = std::filesystem;
+
+  auto &env = _getEnv();
+
+  Ort::SessionOptions session_options;
+  session_options.SetInterOpNumThreads(1);
+  session_options.SetIntraOpNumThreads(std::max(inParams.numIntraOpThreads, 1));
+  session_options.SetGraphOptimizationLevel(inParams.graphOptimizationLevel);
+
+  const void *model = BinaryData::features_model_onnx;
+  const auto model_size =
+      static_cast<size_t>(BinaryData::features_model_onnxSize);
+
+  if (inParams.optimizedModelCacheDir.empty()) {
+    return Ort::Session(env, model, model_size, session_options);
+  }
 
-  mSession = Ort::Session(mEnv, BinaryData::features_model_onnx,
-                          BinaryData::features_model_onnxSize, mSessionOptions);
+  // The optimized model depends on the model, the ONNX Runtime version, the
+  // optimization level and the CPU. A cache copied from another machine is
+  // not loaded, its file name differing.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = fnv1a(model, model_size, hash);
+  const auto ort_version = Ort::GetVersionString();
+  hash = fnv1a(ort_version.data(), ort_version.size(), hash);
+  const auto level = static_cast<int>(inParams.graphOptimizationLevel);
+  hash = fnv1a(&level, sizeof(level), hash);
+  const auto cpu = cpuSignature();
+  hash = fnv1a(cpu.data(), cpu.size(), hash);
+
+  char hash_string[17];
+  std::snprintf(hash_string, sizeof(hash_string), "%016llx",
+                static_cast<unsigned long long>(hash));
+
+  const fs::path cache_file = inParams.optimizedModelCacheDir /
+                              ("features_model_" + std::string(hash_string) +
+                               ".ort");
+
+  std::vector<char> cached_model;
+  if (readFile(cache_file, cached_model)) {
+    try {
+      auto options = session_options.Clone();
+      options.AddConfigEntry("session.load_model_format", "ORT");
+      return Ort::Session(env, cached_model.data(), cached_model.size(),
+                          options);
+    } catch (const Ort::Exception &) {
+      // Corrupted file: optimize again below
+    }
+  }
+
+  std::error_code error;
+  fs::create_directories(inParams.optimizedModelCacheDir, error);
+
+  if (!error) {
+    // Written to a unique file first: several instances can be created
+    // concurrently.
+    fs::path temp_file = cache_file;
+    temp_file += "." + std::to_string(std::random_device()()) + ".tmp";
+
+    try {
+      auto options = session_options.Clone();
+      options.SetOptimizedModelFilePath(temp_file.c_str());
+      options.AddConfigEntry("session.save_model_format", "ORT");
+
+      Ort::Session session(env, model, model_size, options);
+
+      fs::rename(temp_file, cache_file, error);
+      if (error) {
+        fs::remove(temp_file, error);
+      }
+
+      return session;
+    } catch (const Ort::Exception &) {
+      fs::remove(temp_file, error);
+    }
+  }
+
+  return Ort::Session(env, model, model_size, session_options);
 }
 
-const float *Features::computeFeatures(float *inAudio, size_t inNumSamples,
+const float *Features::computeFeatures(const float *inAudio,
+                                       size_t inNumSamples,
                                        size_t &outNumFrames) {
   mInputShape[0] = 1;
   mInputShape[1] = static_cast<int64_t>(inNumSamples);
   mInputShape[2] = 1;
 
-  mInput.clear();
-  mInput.push_back(
-      Ort::Value::CreateTensor<float>(mMemoryInfo, inAudio, inNumSamples,
-                                      mInputShape.data(), mInputShape.size()));
+  // The input tensor is only read by the session
+  auto input = Ort::Value::CreateTensor<float>(
+      mMemoryInfo, const_cast<float *>(inAudio), inNumSamples,
+      mInputShape.data(), mInputShape.size());
+  mIoBinding.BindInput(mInputNames[0], input);
+
+  const float *features = nullptr;
+
+  if (mUseOutputArena && _runWithOutputArena(inNumSamples)) {
+    outNumFrames = static_cast<size_t>(mOutputShape[1]);
+    features = mOutputArena.data();
+  } else {
+    // Outputs allocated by the session
+    mIoBinding.BindOutput(mOutputNames[0], mMemoryInfo);
+    mSession->Run(mRunOptions, mIoBinding);
+    mOutput = mIoBinding.GetOutputValues();
+
+    auto out_shape = mOutput[0].GetTensorTypeAndShapeInfo().GetShape();
+    assert(out_shape[0] == 1 && out_shape[2] == NUM_FREQ_IN &&
+           out_shape[3] == NUM_HARMONICS);
+
+    outNumFrames = static_cast<size_t>(out_shape[1]);
+    features = mOutput[0].GetTensorData<float>();
+
+    // The arena run may have failed for another reason than the shape
+    mUseOutputArena = outNumFrames == expectedNumFrames(inNumSamples);
+  }
+
+  mIoBinding.ClearBoundInputs();
+  mIoBinding.ClearBoundOutputs();
+
+  return features;
+}
+
+bool Features::_runWithOutputArena(size_t inNumSamples) {
+  const size_t num_frames = expectedNumFrames(inNumSamples);
+  const size_t size = num_frames * NUM_FREQ_IN * NUM_HARMONICS;
 
-  mOutput =
-      mSession.Run(mRunOptions, mInputNames, mInput.data(), 1, mOutputNames, 1);
+  if (mOutputArena.size() < size) {
+    mOutputArena.reserve(std::max(size, 2 * mOutputArena.capacity()));
+    mOutputArena.resize(size);
+  }
 
-  auto out_shape = mOutput[0].GetTensorTypeAndShapeInfo().GetShape();
-  assert(out_shape[0] == 1 && out_shape[2] == NUM_FREQ_IN &&
-         out_shape[3] == NUM_HARMONICS);
+  mOutputShape[0] = 1;
+  mOutputShape[1] = static_cast<int64_t>(num_frames);
+  mOutputShape[2] = NUM_FREQ_IN;
+  mOutputShape[3] = NUM_HARMONICS;
 
-  outNumFrames = static_cast<size_t>(out_shape[1]);
+  auto output = Ort::Value::CreateTensor<float>(
+      mMemoryInfo, mOutputArena.data(), size, mOutputShape.data(),
+      mOutputShape.size());
+  mIoBinding.BindOutput(mOutputNames[0], output);
 
-  mInput.clear();
+  try {
+    mSession->Run(mRunOptions, mIoBinding);
+  } catch (const Ort::Exception &) {
+    mIoBinding.ClearBoundOutputs();
+
+    // Terminated by cancel: the fallback run would be terminated too
+    if (mCancelled) {
+      mIoBinding.ClearBoundInputs();
+      throw;
+    }
+
+    return false;
+  }
+
+  // Release the outputs of previous runs allocated by the session
+  mOutput.clear();
+
+  return true;
+}
+
+const float *Features::computeFeatures(const float *inAudio,
+                                       size_t inNumSamples,
+                                       size_t inBeginFrame, size_t inEndFrame,
+                                       size_t &outNumFrames) {
+  assert(inBeginFrame <= inEndFrame);
+
+  const size_t segment_start_frame =
+      inBeginFrame > mNumContextFrames ? inBeginFrame - mNumContextFrames : 0;
+  const size_t segment_start =
+      std::min(segment_start_frame * FFT_HOP, inNumSamples);
+  // Frames past inNumSamples / FFT_HOP + 1 are centered after the end of the
+  // signal: clamp first so that inEndFrame can be arbitrarily large.
+  const size_t segment_end_frame =
+      std::min(inEndFrame, inNumSamples / FFT_HOP + 1) + mNumContextFrames;
+  const size_t segment_end =
+      std::min(segment_end_frame * FFT_HOP, inNumSamples);
+
+  outNumFrames = 0;
+
+  if (segment_start >= segment_end) {
+    return nullptr;
+  }
+
+  size_t segment_num_frames = 0;
+  const float *segment_features =
+      computeFeatures(inAudio + segment_start, segment_end - segment_start,
+                      segment_num_frames);
+
+  const size_t local_begin_frame = inBeginFrame - segment_start_frame;
+
+  if (local_begin_frame >= segment_num_frames) {
+    return nullptr;
+  }
+
+  outNumFrames = std::min(inEndFrame - inBeginFrame,
+                          segment_num_frames - local_begin_frame);
+
+  return segment_features + local_begin_frame * NUM_HARMONICS * NUM_FREQ_IN;
+}
+
+void Features::cancel() {
+  mCancelled = true;
+  mRunOptions.SetTerminate();
+}
 
-  return mOutput[0].GetTensorData<float>();
+void Features::clearCancel() {
+  mCancelled = false;
+  mRunOptions.UnsetTerminate();
 }
@@ -6,7 +6,11 @@
 #define Features_h
 
 #include "cassert"
+#include <atomic>
+#include <filesystem>
+#include <memory>
 #include <onnxruntime_cxx_api.h>
+#include <vector>
 
 #include "BasicPitchConstants.h"
 #include "BinaryData.h"
@@ -14,11 +18,25 @@
 /**
  * Class to compute the CQT and harmonically stack those. Output of this can be
  * given as input to Basic Pitch cnn.
+ * The ONNX Runtime session is shared by all the instances of the process
+ * created with the same parameters.
  */
 class Features {
 public:
+  struct SessionParams {
+    /* Number of threads ONNX Runtime uses to run one call */
+    int numIntraOpThreads = 1;
+    GraphOptimizationLevel graphOptimizationLevel = ORT_ENABLE_ALL;
+    /* Directory where the optimized model is saved in ORT format the first
+     * time and loaded from afterwards. Empty to optimize at every session
+     * creation. */
+    std::filesystem::path optimizedModelCacheDir;
+  };
+
   Features();
 
+  explicit Features(const SessionParams &inParams);
+
   ~Features() = default;
 
   /**
@@ -26,17 +44,98 @@ public:
    * @param inAudio Input audio. Should contain inNumSamples
    * @param inNumSamples Number of samples in inAudio
    * @param outNumFrames Number of frames that have been computed.
-   * @return Pointer to features.
+   * @return Pointer to features. Valid until next call.
+   */
+  const float *computeFeatures(const float *inAudio, size_t inNumSamples,
+                               size_t &outNumFrames);
+
+  /**
+   * Compute features for frames [inBeginFrame, inEndFrame) of the full audio
+   * signal only. The model is run on the audio segment covering these frames
+   * plus mNumContextFrames on each side, so that the CQT kernels see the same
+   * signal around the returned frames as in a full run. Frame f is centered on
+   * sample f * FFT_HOP, so segments always start on a multiple of FFT_HOP.
+   * Note that the model normalizes its log CQT by the min and max over each
+   * call, so values are normalized per segment and differ slightly from the
+   * ones of a call on the whole signal (see
+   * BasicPitch::setSingleFeaturesCall).
+   * @param inAudio Full input audio. Should contain inNumSamples
+   * @param inNumSamples Number of samples in inAudio
+   * @param inBeginFrame First frame to compute
+   * @param inEndFrame Frame after the last one to compute. Can be larger than
+   * the number of frames of the signal to compute all remaining frames.
+   * @param outNumFrames Number of frames that have been computed. Less than
+   * inEndFrame - inBeginFrame if the end of the signal has been reached.
+   * @return Pointer to features of frame inBeginFrame, nullptr if outNumFrames
+   * is 0. Valid until next call.
    */
-  const float *computeFeatures(float *inAudio, size_t inNumSamples,
+  const float *computeFeatures(const float *inAudio, size_t inNumSamples,
+                               size_t inBeginFrame, size_t inEndFrame,
                                size_t &outNumFrames);
 
+  /**
+   * Terminate the running model call and make the next ones fail, until
+   * clearCancel is called. Can be called from any thread. Cancelled calls to
+   * computeFeatures throw Ort::Exception.
+   */
+  void cancel();
+
+  /**
+   * Allow model calls again after cancel.
+   */
+  void clearCancel();
+
+  // Number of frames of audio context given on each side of computed frames.
+  // Covers the longest CQT kernel (lowest bins, ~1 s on each side).
+  static constexpr size_t mNumContextFrames =
+      2 * AUDIO_SAMPLE_RATE / FFT_HOP;
+
 private:
-  // ONNX Runtime Data
-  std::vector<Ort::Value> mInput;
-  std::vector<Ort::Value> mOutput;
+  /**
+   * @return The ONNX Runtime environment of the process.
+   */
+  static Ort::Env &_getEnv();
+
+  /**
+   * Get the session for inParams, shared by all Features instances of the
+   * process. Sessions are created on first use and released with the last
+   * instance using them. Session::Run can be called concurrently, the per
+   * call state (bindings, outputs) being owned by each instance.
+   * @param inParams Session parameters
+   * @return Session
+   */
+  static std::shared_ptr<Ort::Session>
+  _getSharedSession(const SessionParams &inParams);
+
+  /**
+   * Create the session on the embedded model, or on its optimized version
+   * from the cache directory if any. The cached file name contains a hash of
+   * the model, of the session options and of the CPU, so it is regenerated
+   * when they change.
+   * @param inParams Session parameters
+   * @return Session
+   */
+  static Ort::Session _createSession(const SessionParams &inParams);
 
+  /**
+   * Run the model with the input bound to mIoBinding and the output written
+   * to mOutputArena.
+   * @param inNumSamples Number of input samples
+   * @return True on success, false if the output shape is not the expected
+   * one.
+   */
+  bool _runWithOutputArena(size_t inNumSamples);
+
+  // ONNX Runtime Data
   std::array<int64_t, 3> mInputShape;
+  std::array<int64_t, 4> mOutputShape;
+
+  // Output memory bound to the session, grown on demand and reused across
+  // calls
+  std::vector<float> mOutputArena;
+  // False if the model output shape does not follow the expected number of
+  // frames: outputs are then allocated by the session (in its arena).
+  bool mUseOutputArena = true;
 
   // Input and output names of model
   const char *mInputNames[1] = {"input_1"};
@@ -44,10 +143,16 @@ private:
 
   // ONNX Runtime
   Ort::MemoryInfo mMemoryInfo;
-  Ort::SessionOptions mSessionOptions;
-  Ort::Env mEnv;
-  Ort::Session mSession;
+  std::shared_ptr<Ort::Session> mSession;
+  Ort::IoBinding mIoBinding;
   Ort::RunOptions mRunOptions;
+
+  // Set by cancel, along with the terminate flag of mRunOptions
+  std::atomic<bool> mCancelled{false};
+
+  // Outputs allocated by the session, when mOutputArena is not used.
+  // Released before the session.
+  std::vector<Ort::Value> mOutput;
 };
 
 #endif // Features_h
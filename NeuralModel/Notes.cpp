@@ -4,6 +4,8 @@
 
 #include "Notes.h"
 
+#include <array>
+
 bool Notes::Event::operator==(const Notes::Event &other) const {
   return this->startTime == other.startTime && this->endTime == other.endTime &&
          this->startFrame == other.startFrame &&
@@ -11,69 +13,80 @@ bool Notes::Event::operator==(const Notes::Event &other) const {
          this->amplitude == other.amplitude && this->bends == other.bends;
 }
 
-std::vector<Notes::Event>
-Notes::convert(const std::vector<std::vector<float>> &inNotesPG,
-               const std::vector<std::vector<float>> &inOnsetsPG,
-               const std::vector<std::vector<float>> &inContoursPG,
-               const ConvertParams &inParams, bool inNewAudio) {
+std::vector<Notes::Event> Notes::convert(const Posteriorgram &inNotesPG,
+                                         const Posteriorgram &inOnsetsPG,
+                                         const Posteriorgram &inContoursPG,
+                                         const ConvertParams &inParams,
+                                         bool inNewAudio,
+                                         const std::atomic<bool> *inCancelled) {
+  auto is_cancelled = [inCancelled] {
+    return inCancelled != nullptr &&
+           inCancelled->load(std::memory_order_relaxed);
+  };
+
   std::vector<Event> events;
   events.reserve(1024);
 
-  const auto n_frames = static_cast<int>(inNotesPG.size());
+  const auto n_frames = static_cast<int>(inNotesPG.getNumFrames());
   if (n_frames == 0) {
     return events;
   }
 
-  const auto n_notes = static_cast<int>(inNotesPG[0].size());
-  assert(n_frames == inOnsetsPG.size());
-  assert(n_frames == inContoursPG.size());
-  assert(n_notes == inOnsetsPG[0].size());
+  const auto n_notes = static_cast<int>(inNotesPG.getNumBins());
+  assert(n_frames == inOnsetsPG.getNumFrames());
+  assert(n_frames == inContoursPG.getNumFrames());
+  assert(n_notes == inOnsetsPG.getNumBins());
   assert(n_notes == NUM_FREQ_OUT);
 
-  std::vector<std::vector<float>> inferred_onsets;
-  auto onsets_ptr = &inOnsetsPG;
-  if (inParams.inferOnsets) {
-    inferred_onsets = _inferredOnsets<float>(inOnsetsPG, inNotesPG);
-    onsets_ptr = &inferred_onsets;
-  }
-  auto &onsets = *onsets_ptr;
-
   if (inNewAudio) {
+    mHasInferredOnsets = false;
+    mHasOnsetPeaks = false;
+    mHasInferredOnsetPeaks = false;
+    mHasRemainingEnergyIndex = false;
+
     mRemainingEnergy = inNotesPG;
   } else {
-    // Copy without changing the location of the original data
-    assert(mRemainingEnergy.size() == n_frames);
-    for (size_t f = 0; f < n_frames; f++) {
-      assert(inNotesPG[f].size() == NUM_FREQ_OUT);
-      assert(mRemainingEnergy[f].size() == NUM_FREQ_OUT);
-
-      std::copy(inNotesPG[f].begin(), inNotesPG[f].end(),
-                mRemainingEnergy[f].begin());
-    }
+    // Copy without changing the location of the original data, which is
+    // referenced by mRemainingEnergyIndex
+    assert(mRemainingEnergy.getNumFrames() == n_frames);
+    assert(mRemainingEnergy.getNumBins() == NUM_FREQ_OUT);
+
+    std::copy(inNotesPG.data(),
+              inNotesPG.data() + inNotesPG.getNumFrames() * NUM_FREQ_OUT,
+              mRemainingEnergy.data());
   }
 
-  if (inParams.melodiaTrick) {
-    if (inNewAudio) {
-      // Fill mRemainingEnergyIndex
-      mRemainingEnergyIndex.clear();
-      mRemainingEnergyIndex.reserve(static_cast<size_t>(n_frames) *
-                                    static_cast<size_t>(NUM_FREQ_OUT));
-
-      for (int frame_idx = 0; frame_idx < n_frames; frame_idx++) {
-        for (int freq_idx = 0; freq_idx < NUM_FREQ_OUT; freq_idx++) {
-          mRemainingEnergyIndex.push_back(
-              {&mRemainingEnergy[static_cast<size_t>(frame_idx)]
-                                [static_cast<size_t>(freq_idx)],
-               frame_idx, freq_idx});
-        }
-      }
-
-      mRemainingEnergyIndex.shrink_to_fit();
+  const std::vector<_onset_peak> *peaks_ptr = &mOnsetPeaks;
+  if (inParams.inferOnsets) {
+    if (!mHasInferredOnsets) {
+      _inferredOnsets(inOnsetsPG, inNotesPG, mInferredOnsets);
+      mHasInferredOnsets = true;
+    }
+    if (!mHasInferredOnsetPeaks) {
+      _findOnsetPeaks(mInferredOnsets, mInferredOnsetPeaks);
+      mHasInferredOnsetPeaks = true;
     }
+    peaks_ptr = &mInferredOnsetPeaks;
+  } else if (!mHasOnsetPeaks) {
+    _findOnsetPeaks(inOnsetsPG, mOnsetPeaks);
+    mHasOnsetPeaks = true;
   }
+  const auto &peaks = *peaks_ptr;
 
   const auto frame_threshold = inParams.frameThreshold;
 
+  // The index is sorted on the energies of inNotesPG: cells are only ever
+  // zeroed afterwards, so this is also the order of the remaining energies
+  // once zeroed cells are skipped. It only holds the cells above the frame
+  // threshold it was built for, and is rebuilt when the threshold is lowered.
+  if (inParams.melodiaTrick &&
+      (!mHasRemainingEnergyIndex ||
+       frame_threshold < mRemainingEnergyIndexThreshold)) {
+    _sortRemainingEnergyIndex(frame_threshold);
+    mHasRemainingEnergyIndex = true;
+    mRemainingEnergyIndexThreshold = frame_threshold;
+  }
+
   // constrain frequencies
   const auto max_note_idx =
       inParams.maxFrequency < 0
@@ -87,75 +100,70 @@ Notes::convert(const std::vector<std::vector<float>> &inNotesPG,
   // stop 1 frame early to prevent edge case
   const int last_frame = n_frames - 1;
 
-  // Go backwards in time
-  for (int frame_idx = last_frame - 1; frame_idx >= 0; frame_idx--) {
-    for (int note_idx = max_note_idx; note_idx >= min_note_idx; note_idx--) {
-      auto onset = onsets[frame_idx][note_idx];
-
-      // equivalent to argrelmax logic
-      auto prev = frame_idx <= 0 ? onset : onsets[frame_idx - 1][note_idx];
-      auto next =
-          frame_idx >= last_frame ? onset : onsets[frame_idx + 1][note_idx];
+  // Go backwards in time, through the onset peaks only
+  for (const auto &[frame_idx, note_idx, onset] : peaks) {
+    if (is_cancelled()) {
+      return {};
+    }
 
-      if (onset < inParams.onsetThreshold || onset < prev || onset < next) {
-        continue;
-      }
+    if (note_idx > max_note_idx || note_idx < min_note_idx ||
+        onset < inParams.onsetThreshold) {
+      continue;
+    }
 
-      // find time index at this frequency band where the frames drop below an
-      // energy threshold
-      int i = frame_idx + 1;
-      int k = 0; // number of frames since energy dropped below threshold
-      while (i < last_frame && k < inParams.energyThreshold) {
-        if (mRemainingEnergy[i][note_idx] < frame_threshold) {
-          k++;
-        } else {
-          k = 0;
-        }
-        i++;
+    // find time index at this frequency band where the frames drop below an
+    // energy threshold
+    int i = frame_idx + 1;
+    int k = 0; // number of frames since energy dropped below threshold
+    while (i < last_frame && k < inParams.energyThreshold) {
+      if (mRemainingEnergy[i][note_idx] < frame_threshold) {
+        k++;
+      } else {
+        k = 0;
       }
+      i++;
+    }
 
-      i -= k; // go back to frame above threshold
+    i -= k; // go back to frame above threshold
 
-      // if the note is too short, skip it
-      if (i - frame_idx <= inParams.minNoteLength) {
-        continue;
-      }
+    // if the note is too short, skip it
+    if (i - frame_idx <= inParams.minNoteLength) {
+      continue;
+    }
 
-      double amplitude = 0.0;
-      for (int f = frame_idx; f < i; f++) {
-        amplitude += mRemainingEnergy[f][note_idx];
-        mRemainingEnergy[f][note_idx] = 0;
+    double amplitude = 0.0;
+    for (int f = frame_idx; f < i; f++) {
+      amplitude += mRemainingEnergy[f][note_idx];
+      mRemainingEnergy[f][note_idx] = 0;
 
-        if (note_idx < MAX_NOTE_IDX) {
-          mRemainingEnergy[f][note_idx + 1] = 0;
-        }
-        if (note_idx > 0) {
-          mRemainingEnergy[f][note_idx - 1] = 0;
-        }
+      if (note_idx < MAX_NOTE_IDX) {
+        mRemainingEnergy[f][note_idx + 1] = 0;
+      }
+      if (note_idx > 0) {
+        mRemainingEnergy[f][note_idx - 1] = 0;
       }
+    }
 
-      amplitude /= (i - frame_idx);
+    amplitude /= (i - frame_idx);
 
-      events.push_back(Event{
-          _modelFrameToTime(frame_idx) /* startTime */,
-          _modelFrameToTime(i) /* endTime */,
-          frame_idx /* startFrame */,
-          i /* endFrame */,
-          note_idx + MIDI_OFFSET /* pitch */,
-          amplitude /* amplitude */,
-      });
-    }
+    events.push_back(Event{
+        _modelFrameToTime(frame_idx) /* startTime */,
+        _modelFrameToTime(i) /* endTime */,
+        frame_idx /* startFrame */,
+        i /* endFrame */,
+        note_idx + MIDI_OFFSET /* pitch */,
+        amplitude /* amplitude */,
+    });
   }
 
   if (inParams.melodiaTrick) {
-    std::sort(mRemainingEnergyIndex.begin(), mRemainingEnergyIndex.end(),
-              [](const _pg_index &a, const _pg_index &b) {
-                return *a.value > *b.value;
-              });
-
     // loop through each remaining note probability in descending order
     // until reaching frame_threshold.
     for (auto &[energy_ptr, frame_idx, note_idx] : mRemainingEnergyIndex) {
+      if (is_cancelled()) {
+        return {};
+      }
+
       auto &energy = *energy_ptr;
 
       // skip those that have already been zeroed
@@ -170,8 +178,8 @@ Notes::convert(const std::vector<std::vector<float>> &inNotesPG,
 
       // this inhibit function zeroes out neighbor notes and keeps track (with
       // k) on how many consecutive frames were below frame_threshold.
-      auto inhibit = [frame_threshold](std::vector<std::vector<float>> &pg,
-                                       int frame_i, int note_i, int k) {
+      auto inhibit = [frame_threshold](Posteriorgram &pg, int frame_i,
+                                       int note_i, int k) {
         if (pg[frame_i][note_i] < frame_threshold) {
           k++;
         } else {
@@ -232,6 +240,10 @@ Notes::convert(const std::vector<std::vector<float>> &inNotesPG,
 
   sortEvents(events);
 
+  if (is_cancelled()) {
+    return {};
+  }
+
   if (inParams.pitchBend != NoPitchBend) {
     _addPitchBends(events, inContoursPG);
     if (inParams.pitchBend == SinglePitchBend) {
@@ -244,15 +256,178 @@ Notes::convert(const std::vector<std::vector<float>> &inNotesPG,
 
 void Notes::clear() {
   mRemainingEnergy.clear();
-  mRemainingEnergy.shrink_to_fit();
 
   mRemainingEnergyIndex.clear();
   mRemainingEnergyIndex.shrink_to_fit();
+
+  mInferredOnsets.clear();
+  mOnsetPeaks.clear();
+  mOnsetPeaks.shrink_to_fit();
+  mInferredOnsetPeaks.clear();
+  mInferredOnsetPeaks.shrink_to_fit();
+
+  mHasInferredOnsets = false;
+  mHasOnsetPeaks = false;
+  mHasInferredOnsetPeaks = false;
+  mHasRemainingEnergyIndex = false;
+}
+
+void Notes::_inferredOnsets(const Posteriorgram &inOnsetsPG,
+                            const Posteriorgram &inNotesPG,
+                            Posteriorgram &outInferredOnsets, int inNumDiffs) {
+  const size_t n_frames = inNotesPG.getNumFrames();
+  const size_t n_notes = inNotesPG.getNumBins();
+  const auto n_diffs = static_cast<size_t>(inNumDiffs);
+
+  assert(n_notes <= NUM_FREQ_OUT);
+  assert(inOnsetsPG.getNumFrames() == n_frames);
+  assert(inOnsetsPG.getNumBins() == n_notes);
+
+  // Notes of the frames before the signal
+  static const std::array<float, NUM_FREQ_OUT> zeros{};
+
+  // Maxima per note, reduced after the pass so that the loops over notes carry
+  // no dependency and vectorize.
+  std::array<float, NUM_FREQ_OUT> max_onsets{};
+  std::array<float, NUM_FREQ_OUT> max_min_notes_diffs{};
+
+  outInferredOnsets.resize(n_frames, n_notes);
+
+  // The output starts as the minima of the increase of note probabilities
+  // from the frames behind by 1 to n_diffs (notes_diff in Basic Pitch).
+  // Initialized to 1 to not interfere with the minima, assuming all values of
+  // inNotesPG are probabilities < 1. Negative minima are zeroed.
+  for (size_t i = 0; i < n_frames; i++) {
+    const float *notes = inNotesPG[i];
+    const float *onsets = inOnsetsPG[i];
+    float *mins = outInferredOnsets[i];
+
+    std::fill(mins, mins + n_notes, 1.0f);
+
+    for (size_t offset = 1; offset <= n_diffs; offset++) {
+      const float *notes_behind =
+          (i >= offset) ? inNotesPG[i - offset] : zeros.data();
+      for (size_t j = 0; j < n_notes; j++) {
+        mins[j] = std::min(mins[j], notes[j] - notes_behind[j]);
+      }
+    }
+
+    if (i >= n_diffs) {
+      for (size_t j = 0; j < n_notes; j++) {
+        mins[j] = std::max(mins[j], 0.0f);
+      }
+    } else {
+      // Basic Pitch zeroes the first frames as soon as a diff is below the
+      // running minimum
+      // https://github.com/spotify/basic-pitch/blob/86fc60dab06e3115758eb670c92ead3b62a89b47/basic_pitch/note_creation.py#L298
+      for (size_t j = 0; j < n_notes; j++) {
+        mins[j] = (mins[j] < 1.0f) ? 0.0f : 1.0f;
+      }
+    }
+
+    for (size_t j = 0; j < n_notes; j++) {
+      max_onsets[j] = std::max(max_onsets[j], onsets[j]);
+      max_min_notes_diffs[j] = std::max(max_min_notes_diffs[j], mins[j]);
+    }
+  }
+
+  const float max_onset =
+      *std::max_element(max_onsets.begin(), max_onsets.end());
+  const float max_min_notes_diff = *std::max_element(
+      max_min_notes_diffs.begin(), max_min_notes_diffs.end());
+
+  // Rescale the minima to match the scale of the original onsets and choose
+  // the element-wise max between them and the original onsets.
+  for (size_t i = 0; i < n_frames; i++) {
+    const float *onsets = inOnsetsPG[i];
+    float *inferred = outInferredOnsets[i];
+    for (size_t j = 0; j < n_notes; j++) {
+      inferred[j] =
+          std::max(max_onset * inferred[j] / max_min_notes_diff, onsets[j]);
+    }
+  }
+}
+
+void Notes::_findOnsetPeaks(const Posteriorgram &inOnsetsPG,
+                            std::vector<_onset_peak> &outPeaks) {
+  const auto n_frames = static_cast<int>(inOnsetsPG.getNumFrames());
+  const auto n_notes = static_cast<int>(inOnsetsPG.getNumBins());
+
+  outPeaks.clear();
+
+  // stop 1 frame early to prevent edge case
+  const int last_frame = n_frames - 1;
+
+  for (int frame_idx = last_frame - 1; frame_idx >= 0; frame_idx--) {
+    const float *onsets = inOnsetsPG[frame_idx];
+    const float *prev_onsets =
+        frame_idx <= 0 ? onsets : inOnsetsPG[frame_idx - 1];
+    const float *next_onsets = inOnsetsPG[frame_idx + 1];
+
+    for (int note_idx = n_notes - 1; note_idx >= 0; note_idx--) {
+      // equivalent to argrelmax logic
+      const auto onset = onsets[note_idx];
+      if (onset < prev_onsets[note_idx] || onset < next_onsets[note_idx]) {
+        continue;
+      }
+
+      outPeaks.push_back({frame_idx, note_idx, onset});
+    }
+  }
+}
+
+void Notes::_sortRemainingEnergyIndex(float inThreshold) {
+  const auto n_frames = static_cast<int>(mRemainingEnergy.getNumFrames());
+
+  // Cells at or below the threshold are never visited: the melodia pass stops
+  // at the first one.
+  mRemainingEnergyIndex.clear();
+
+  for (int frame_idx = 0; frame_idx < n_frames; frame_idx++) {
+    float *energies = mRemainingEnergy[static_cast<size_t>(frame_idx)];
+    for (int freq_idx = 0; freq_idx < NUM_FREQ_OUT; freq_idx++) {
+      if (energies[freq_idx] > inThreshold) {
+        mRemainingEnergyIndex.push_back(
+            {&energies[freq_idx], frame_idx, freq_idx});
+      }
+    }
+  }
+
+  // Ties are broken by position so that the order does not depend on the
+  // sort implementation
+  std::sort(mRemainingEnergyIndex.begin(), mRemainingEnergyIndex.end(),
+            [](const _pg_index &a, const _pg_index &b) {
+              return *a.value > *b.value ||
+                     (*a.value == *b.value && a.value < b.value);
+            });
 }
 
 void Notes::_addPitchBends(std::vector<Event> &inOutEvents,
-                           const std::vector<std::vector<float>> &inContoursPG,
-                           int inNumBinsTolerance) {
+                           const Posteriorgram &inContoursPG) {
+  static constexpr int N_FREQ_BINS_CONTOURS =
+      NUM_FREQ_OUT * CONTOURS_BINS_PER_SEMITONE;
+  static constexpr int tolerance = mPitchBendNumBinsTolerance;
+  static constexpr int window_size = 2 * tolerance + 1;
+
+  // Lanes of the max reduction, the window being zero padded to a multiple
+  static constexpr int num_lanes = 8;
+  static constexpr int padded_size =
+      (window_size + num_lanes - 1) / num_lanes * num_lanes;
+
+  // Gaussian window over the bins around the note (index tolerance), computed
+  // once
+  static const std::array<float, window_size> gaussian = [] {
+    std::array<float, window_size> window{};
+    for (int k = 0; k < window_size; k++) {
+      const auto n = static_cast<float>(k - tolerance);
+      static constexpr float std = 5.0f;
+      window[k] = std::exp(-(n * n) / (2.0f * std * std));
+    }
+    return window;
+  }();
+
+  std::array<float, padded_size> weighted{};
+
   for (auto &event : inOutEvents) {
     // midi_pitch_to_contour_bin
     int note_idx = CONTOURS_BINS_PER_SEMITONE *
@@ -260,33 +435,41 @@ void Notes::_addPitchBends(std::vector<Event> &inOutEvents,
                     12 * static_cast<int>(std::round(
                              std::log2(440.0f / ANNOTATIONS_BASE_FREQUENCY))));
 
-    static constexpr int N_FREQ_BINS_CONTOURS =
-        NUM_FREQ_OUT * CONTOURS_BINS_PER_SEMITONE;
-    int note_start_idx = std::max(note_idx - inNumBinsTolerance, 0);
+    int note_start_idx = std::max(note_idx - tolerance, 0);
     int note_end_idx =
-        std::min(N_FREQ_BINS_CONTOURS, note_idx + inNumBinsTolerance + 1);
+        std::min(N_FREQ_BINS_CONTOURS, note_idx + tolerance + 1);
+    const int num_bins = std::max(note_end_idx - note_start_idx, 0);
 
-    const auto gauss_start =
-        static_cast<float>(std::max(0, inNumBinsTolerance - note_idx));
-    const auto pb_shift =
-        inNumBinsTolerance - std::max(0, inNumBinsTolerance - note_idx);
+    const float *window = gaussian.data() + note_start_idx - note_idx +
+                          tolerance;
+    const auto pb_shift = tolerance - std::max(0, tolerance - note_idx);
 
-    for (int i = event.startFrame; i < event.endFrame; i++) {
-      int bend = 0;
-      float max = 0;
-      for (int j = note_start_idx; j < note_end_idx; j++) {
-        int k = j - note_start_idx;
-        float x = gauss_start + static_cast<float>(k);
-        float n = x - static_cast<float>(inNumBinsTolerance);
+    // Bins beyond num_bins stay 0 for all frames of the note
+    std::fill(weighted.begin(), weighted.end(), 0.0f);
+    event.bends.reserve(event.bends.size() +
+                        std::max(event.endFrame - event.startFrame, 0));
 
-        static constexpr float std = 5.0f;
+    for (int i = event.startFrame; i < event.endFrame; i++) {
+      const float *contours = inContoursPG[i] + note_start_idx;
+      for (int k = 0; k < num_bins; k++) {
+        weighted[k] = window[k] * contours[k];
+      }
 
-        // Gaussian
-        float w = std::exp(-(n * n) / (2.0f * std * std)) * inContoursPG[i][j];
+      // Per lane maxima: the loops vectorize without reassociating a scalar
+      // reduction
+      std::array<float, num_lanes> lane_max{};
+      for (int k = 0; k < padded_size; k += num_lanes) {
+        for (int lane = 0; lane < num_lanes; lane++) {
+          lane_max[lane] = std::max(lane_max[lane], weighted[k + lane]);
+        }
+      }
+      const float max = *std::max_element(lane_max.begin(), lane_max.end());
 
-        if (w > max) {
-          bend = k;
-          max = w;
+      // First bin reaching the maximum, none if all weights are 0
+      int bend = 0;
+      if (max > 0.0f) {
+        while (weighted[bend] != max) {
+          bend++;
         }
       }
       event.bends.emplace_back(bend - pb_shift);
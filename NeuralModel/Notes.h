@@ -6,12 +6,14 @@
 #define Notes_h
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <vector>
 
 #include "BasicPitchConstants.h"
 #include "NoteUtils.h"
+#include "Posteriorgram.h"
 
 enum PitchBendModes { NoPitchBend = 0, SinglePitchBend, MultiPitchBend };
 
@@ -51,6 +53,10 @@ public:
 
   /**
    * Create note events based on postegriorgram inputs
+   * The parameter independent intermediates (inferred onsets, onset peaks and
+   * the sorted energy index) are computed on first use for a given audio and
+   * reused by the following calls with inNewAudio == false, so that only the
+   * threshold dependent passes are run when parameters change.
    * @param inNotesPG Note posteriorgrams
    * @param inOnsetsPG Onset posteriorgrams
    * @param inContoursPG Contour posteriorgrams
@@ -58,13 +64,15 @@ public:
    * @param inNewAudio True: first time calling this function with this audio
    * (these inNotesPG, inOnsetsPG, inContoursPG). False if same audio as last
    * time with updated parameters.
+   * @param inCancelled Optional flag checked while converting. Once it is set,
+   * the conversion stops and returns no events. Cached passes stay valid.
    * @return
    */
-  std::vector<Event>
-  convert(const std::vector<std::vector<float>> &inNotesPG,
-          const std::vector<std::vector<float>> &inOnsetsPG,
-          const std::vector<std::vector<float>> &inContoursPG,
-          const ConvertParams &inParams, bool inNewAudio);
+  std::vector<Event> convert(const Posteriorgram &inNotesPG,
+                             const Posteriorgram &inOnsetsPG,
+                             const Posteriorgram &inContoursPG,
+                             const ConvertParams &inParams, bool inNewAudio,
+                             const std::atomic<bool> *inCancelled = nullptr);
 
   /**
    * Release any memory allocated by the class.
@@ -134,16 +142,21 @@ public:
   }
 
 private:
+  // Benchmarks of the private passes (Tools/TranscriptionBenchmarks.cpp)
+  friend struct BenchmarkAccess;
+
   /**
-   * Add pitch bend vector to note events.
+   * Add pitch bend vector to note events. The bend of a frame is the contour
+   * bin within mPitchBendNumBinsTolerance of the note with the highest
+   * contour, weighted by a Gaussian window centered on the note.
    * @param inOutEvents event vector (input and output)
    * @param inContoursPG Contour posteriorgram matrix
-   * @param inNumBinsTolerance
    */
-  static void
-  _addPitchBends(std::vector<Notes::Event> &inOutEvents,
-                 const std::vector<std::vector<float>> &inContoursPG,
-                 int inNumBinsTolerance = 25);
+  static void _addPitchBends(std::vector<Notes::Event> &inOutEvents,
+                             const Posteriorgram &inContoursPG);
+
+  // Max distance in contour bins between a note and its bends
+  static constexpr int mPitchBendNumBinsTolerance = 25;
 
   /**
    * Get time in seconds given frame index.
@@ -178,93 +191,20 @@ private:
   }
 
   /**
-   * Returns a version of inOnsetsPG augmented by detecting differences in note
+   * Compute a version of inOnsetsPG augmented by detecting differences in note
    * posteriorgrams across frames separated by varying offsets (up to
-   * inNumDiffs).
-   * @tparam T
+   * inNumDiffs). Rows are processed with branch-free min / max loops over the
+   * notes, which the compiler vectorizes.
    * @param inOnsetsPG Onset posteriorgrams
    * @param inNotesPG Note posteriorgrams
+   * @param outInferredOnsets Inferred onsets. Its memory is reused if it is
+   * large enough.
    * @param inNumDiffs max varying offset.
-   * @return
    */
-  // TODO: change to float
-  template <typename T>
-  static std::vector<std::vector<T>>
-  _inferredOnsets(const std::vector<std::vector<T>> &inOnsetsPG,
-                  const std::vector<std::vector<T>> &inNotesPG,
-                  int inNumDiffs = 2) {
-    auto n_frames = inNotesPG.size();
-    auto n_notes = inNotesPG[0].size();
-
-    // The algorithm starts by calculating a diff of note posteriorgrams, hence
-    // the name notes_diff. This same variable will later morph into the
-    // inferred onsets output notes_diff needs to be initialized to all 1 to not
-    // interfere with minima calculations, assuming all values in inNotesPG are
-    // probabilities < 1.
-    auto notes_diff =
-        std::vector<std::vector<T>>(n_frames, std::vector<T>(n_notes, 1));
-
-    // max of minima of notes_diff
-    T max_min_notes_diff = 0;
-    // max of onsets
-    T max_onset = 0;
-
-    // for each frame offset
-    for (int n = 0; n < inNumDiffs; n++) {
-      auto offset = n + 1;
-      // for each frame
-      for (int i = 0; i < n_frames; i++) {
-        // frame index slided back by offset
-        auto i_behind = i - offset;
-        // for each note
-        for (int j = 0; j < n_notes; j++) {
-          // calculate the difference in note probabilities between frame i and
-          // frame i_behind (the frame behind by offset).
-          auto diff =
-              inNotesPG[i][j] - ((i_behind >= 0) ? inNotesPG[i_behind][j] : 0);
-
-          // Basic Pitch calculates the minimum amongst positive and negative
-          // diffs instead of ignoring negative diffs (which mean "end of note")
-          // while we are only looking for "start of note" (aka onset).
-          // TODO: the zeroing of negative diff should probably happen before
-          // searching for minimum
-          auto &min = notes_diff[i][j];
-          if (diff < min) {
-            diff = (diff < 0) ? 0 : diff;
-            // https://github.com/spotify/basic-pitch/blob/86fc60dab06e3115758eb670c92ead3b62a89b47/basic_pitch/note_creation.py#L298
-            min = (i >= inNumDiffs) ? diff : 0;
-          }
-
-          // if last diff, max_min_notes_diff can be computed
-          if (offset == inNumDiffs) {
-            auto onset = inOnsetsPG[i][j];
-            if (onset > max_onset) {
-              max_onset = onset;
-            }
-            if (min > max_min_notes_diff) {
-              max_min_notes_diff = min;
-            }
-          }
-        }
-      }
-    }
-
-    // Rescale notes_diff in-place to match scale of original onsets
-    // and choose the element-wise max between it and the original onsets.
-    // This is where notes_diff morphs truly into the inferred onsets.
-    for (int i = 0; i < n_frames; i++) {
-      for (int j = 0; j < n_notes; j++) {
-        auto &inferred = notes_diff[i][j];
-        inferred = max_onset * inferred / max_min_notes_diff;
-        auto orig = inOnsetsPG[i][j];
-        if (orig > inferred) {
-          inferred = orig;
-        }
-      }
-    }
-
-    return notes_diff;
-  }
+  static void _inferredOnsets(const Posteriorgram &inOnsetsPG,
+                              const Posteriorgram &inNotesPG,
+                              Posteriorgram &outInferredOnsets,
+                              int inNumDiffs = 2);
 
   struct _pg_index {
     float *value;
@@ -272,8 +212,43 @@ private:
     int noteIdx;
   };
 
-  std::vector<std::vector<float>> mRemainingEnergy;
+  struct _onset_peak {
+    int frameIdx;
+    int noteIdx;
+    float onset;
+  };
+
+  /**
+   * Find the local maxima in time of each pitch of the onsets (argrelmax
+   * logic, plateaus included), in the order they are visited by convert:
+   * backwards in time, then from the highest pitch to the lowest.
+   * The last frame is never a peak.
+   * @param inOnsetsPG Onset posteriorgrams (original or inferred)
+   * @param outPeaks Onset peaks
+   */
+  static void _findOnsetPeaks(const Posteriorgram &inOnsetsPG,
+                              std::vector<_onset_peak> &outPeaks);
+
+  /**
+   * Fill mRemainingEnergyIndex with the cells of mRemainingEnergy above
+   * inThreshold, sorted by decreasing energy. Must be called before any cell
+   * is zeroed. The index stays valid for any frame threshold >= inThreshold.
+   * @param inThreshold Energy threshold
+   */
+  void _sortRemainingEnergyIndex(float inThreshold);
+
+  Posteriorgram mRemainingEnergy;
   std::vector<_pg_index> mRemainingEnergyIndex;
+
+  // Parameter independent intermediates, valid for the current audio
+  Posteriorgram mInferredOnsets;
+  std::vector<_onset_peak> mOnsetPeaks;
+  std::vector<_onset_peak> mInferredOnsetPeaks;
+  bool mHasInferredOnsets = false;
+  bool mHasOnsetPeaks = false;
+  bool mHasInferredOnsetPeaks = false;
+  bool mHasRemainingEnergyIndex = false;
+  float mRemainingEnergyIndexThreshold = 0;
 };
 
 #endif // Notes_h
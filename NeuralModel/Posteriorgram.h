@@ -0,0 +1,162 @@
+//
+// Posteriorgram.h
+//
+
+#ifndef Posteriorgram_h
+#define Posteriorgram_h
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Minimal allocator returning memory aligned on Alignment bytes, so that rows
+ * of posteriorgrams can be loaded with aligned SIMD instructions.
+ */
+template <typename T, size_t Alignment> struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+  T *allocate(size_t inNum) {
+    return static_cast<T *>(
+        ::operator new(inNum * sizeof(T), std::align_val_t(Alignment)));
+  }
+
+  void deallocate(T *inPtr, size_t) noexcept {
+    ::operator delete(inPtr, std::align_val_t(Alignment));
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept {
+    return false;
+  }
+};
+
+/**
+ * Non owning view on a range of frames of a posteriorgram. Rows are separated
+ * by stride elements.
+ * @tparam T float or const float
+ */
+template <typename T> struct PosteriorgramView {
+  T *data = nullptr;
+  size_t numFrames = 0;
+  size_t numBins = 0;
+  size_t stride = 0;
+
+  T *operator[](size_t inFrame) const {
+    assert(inFrame < numFrames);
+    return data + inFrame * stride;
+  }
+};
+
+/**
+ * Posteriorgram matrix (frames x bins) stored row-major in a single aligned
+ * allocation. pg[frame][bin] can be used as with nested vectors.
+ */
+class Posteriorgram {
+public:
+  static constexpr size_t Alignment = 64;
+
+  Posteriorgram() = default;
+
+  Posteriorgram(size_t inNumFrames, size_t inNumBins) {
+    resize(inNumFrames, inNumBins);
+  }
+
+  /**
+   * Resize the matrix. If the number of bins is unchanged, existing frames are
+   * kept. New values are set to 0.
+   * @param inNumFrames Number of frames (rows)
+   * @param inNumBins Number of bins per frame (columns)
+   */
+  void resize(size_t inNumFrames, size_t inNumBins) {
+    if (inNumBins != mNumBins) {
+      mData.clear();
+      mNumBins = inNumBins;
+    }
+
+    mData.resize(inNumFrames * inNumBins, 0.0f);
+    mNumFrames = inNumFrames;
+  }
+
+  /**
+   * Reserve memory for inNumFrames frames of inNumBins bins, so that growing up
+   * to that size does not reallocate.
+   */
+  void reserve(size_t inNumFrames, size_t inNumBins) {
+    mData.reserve(inNumFrames * inNumBins);
+  }
+
+  /**
+   * Remove all frames and release memory.
+   */
+  void clear() {
+    mData.clear();
+    mData.shrink_to_fit();
+    mNumFrames = 0;
+  }
+
+  void fill(float inValue) { std::fill(mData.begin(), mData.end(), inValue); }
+
+  bool empty() const { return mNumFrames == 0; }
+
+  size_t getNumFrames() const { return mNumFrames; }
+
+  size_t getNumBins() const { return mNumBins; }
+
+  size_t getStride() const { return mNumBins; }
+
+  float *data() { return mData.data(); }
+
+  const float *data() const { return mData.data(); }
+
+  float *operator[](size_t inFrame) {
+    assert(inFrame < mNumFrames);
+    return mData.data() + inFrame * mNumBins;
+  }
+
+  const float *operator[](size_t inFrame) const {
+    assert(inFrame < mNumFrames);
+    return mData.data() + inFrame * mNumBins;
+  }
+
+  /**
+   * @param inFirstFrame First frame of the view
+   * @param inNumFrames Number of frames in the view
+   * @return View on frames [inFirstFrame, inFirstFrame + inNumFrames)
+   */
+  PosteriorgramView<float> getView(size_t inFirstFrame, size_t inNumFrames) {
+    assert(inFirstFrame + inNumFrames <= mNumFrames);
+    return {mData.data() + inFirstFrame * mNumBins, inNumFrames, mNumBins,
+            mNumBins};
+  }
+
+  PosteriorgramView<const float> getView(size_t inFirstFrame,
+                                         size_t inNumFrames) const {
+    assert(inFirstFrame + inNumFrames <= mNumFrames);
+    return {mData.data() + inFirstFrame * mNumBins, inNumFrames, mNumBins,
+            mNumBins};
+  }
+
+private:
+  std::vector<float, AlignedAllocator<float, Alignment>> mData;
+  size_t mNumFrames = 0;
+  size_t mNumBins = 0;
+};
+
+#endif // Posteriorgram_h
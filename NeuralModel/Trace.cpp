@@ -0,0 +1,113 @@
+//
+// Scoped timers and counters of the transcription stages.
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace Trace {
+
+Recorder &Recorder::get() {
+  static Recorder recorder;
+  return recorder;
+}
+
+Recorder::Recorder() : mEpoch(std::chrono::steady_clock::now()) {}
+
+void Recorder::record(const char *inName,
+                      std::chrono::steady_clock::time_point inBegin,
+                      std::chrono::steady_clock::time_point inEnd,
+                      int64_t inBytes, int64_t inFrames) {
+  using Us = std::chrono::duration<double, std::micro>;
+  const double begin_us = Us(inBegin - mEpoch).count();
+  const double duration_us = Us(inEnd - inBegin).count();
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  auto totals = std::find_if(mTotals.begin(), mTotals.end(),
+                             [inName](const StageTotals &inTotals) {
+                               return inTotals.name == inName;
+                             });
+  if (totals == mTotals.end()) {
+    mTotals.push_back(StageTotals{inName});
+    totals = mTotals.end() - 1;
+  }
+
+  totals->numEvents++;
+  totals->totalUs += duration_us;
+  totals->bytes += inBytes;
+  totals->frames += inFrames;
+
+  if (mEvents.size() < mMaxEvents) {
+    mEvents.push_back(Event{inName, begin_us, duration_us, _getThreadIdx(),
+                            inBytes, inFrames});
+  }
+}
+
+void Recorder::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEvents.clear();
+  mTotals.clear();
+}
+
+std::vector<Event> Recorder::getEvents() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mEvents;
+}
+
+std::vector<StageTotals> Recorder::getStageTotals() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mTotals;
+}
+
+std::string Recorder::toChromeTraceJson() const {
+  const auto events = getEvents();
+
+  std::string json = "{\"traceEvents\":[";
+  char buffer[256];
+
+  for (size_t i = 0; i < events.size(); i++) {
+    const auto &event = events[i];
+    const bool is_count = event.durationUs == 0.0;
+
+    // Stage names are literals of this code base, no escaping is needed
+    if (is_count) {
+      std::snprintf(buffer, sizeof(buffer),
+                    "%s\n{\"name\":\"%s\",\"cat\":\"sample2midi\",\"ph\":\"i\","
+                    "\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,",
+                    i == 0 ? "" : ",", event.name, event.threadIdx,
+                    event.beginUs);
+    } else {
+      std::snprintf(buffer, sizeof(buffer),
+                    "%s\n{\"name\":\"%s\",\"cat\":\"sample2midi\",\"ph\":\"X\","
+                    "\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,",
+                    i == 0 ? "" : ",", event.name, event.threadIdx,
+                    event.beginUs, event.durationUs);
+    }
+    json += buffer;
+
+    std::snprintf(buffer, sizeof(buffer),
+                  "\"args\":{\"bytes\":%" PRId64 ",\"frames\":%" PRId64 "}}",
+                  event.bytes, event.frames);
+    json += buffer;
+  }
+
+  json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return json;
+}
+
+int Recorder::_getThreadIdx() {
+  const auto id = std::this_thread::get_id();
+  const auto it = std::find(mThreadIds.begin(), mThreadIds.end(), id);
+  if (it != mThreadIds.end()) {
+    return static_cast<int>(it - mThreadIds.begin());
+  }
+
+  mThreadIds.push_back(id);
+  return static_cast<int>(mThreadIds.size() - 1);
+}
+
+} // namespace Trace
@@ -0,0 +1,177 @@
+//
+// Scoped timers and counters of the transcription stages.
+//
+
+#ifndef Trace_h
+#define Trace_h
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tracing is compiled in with SAMPLE2MIDI_TRACE=1 (CMake option
+// SAMPLE2MIDI_ENABLE_TRACE). Otherwise the TRACE_ macros expand to nothing.
+#ifndef SAMPLE2MIDI_TRACE
+#define SAMPLE2MIDI_TRACE 0
+#endif
+
+/**
+ * Timings and counters of the stages of the pipeline, recorded by the process
+ * wide Trace::Recorder:
+ * - load, decode: opening and decoding the file (audio frames)
+ * - resample: downmix and resampling to 22050 Hz (audio frames)
+ * - cqt, cnn, notes: features model, CNN and notes conversion (model frames)
+ * - bpm, key: tempo and key detection (audio frames)
+ * - export: writing the MIDI file (notes)
+ * Bytes are those of the buffers a stage allocates (written for export).
+ */
+namespace Trace {
+
+/**
+ * A timed scope, or a count if durationUs is 0.
+ */
+struct Event {
+  const char *name;
+  double beginUs;
+  double durationUs;
+  int threadIdx;
+  int64_t bytes;
+  int64_t frames;
+};
+
+/**
+ * Sums of the events of a stage.
+ */
+struct StageTotals {
+  std::string name;
+  int64_t numEvents = 0;
+  double totalUs = 0.0;
+  int64_t bytes = 0;
+  int64_t frames = 0;
+};
+
+class Recorder {
+public:
+  /**
+   * @return The recorder of the process.
+   */
+  static Recorder &get();
+
+  /**
+   * Record an event. Can be called from any thread.
+   * @param inName Stage name, must outlive the recorder (string literal).
+   * @param inBegin Start of the event
+   * @param inEnd End of the event (inBegin for a count)
+   * @param inBytes Bytes allocated
+   * @param inFrames Frames processed
+   */
+  void record(const char *inName, std::chrono::steady_clock::time_point inBegin,
+              std::chrono::steady_clock::time_point inEnd, int64_t inBytes,
+              int64_t inFrames);
+
+  /**
+   * Remove all the events and totals.
+   */
+  void clear();
+
+  /**
+   * @return Recorded events, in recording order. Events beyond mMaxEvents are
+   * only counted in the totals.
+   */
+  std::vector<Event> getEvents() const;
+
+  /**
+   * @return Totals per stage, in order of first event.
+   */
+  std::vector<StageTotals> getStageTotals() const;
+
+  /**
+   * @return Recorded events in Chrome trace event format (JSON), for
+   * chrome://tracing or Perfetto. Counts are instant events.
+   */
+  std::string toChromeTraceJson() const;
+
+private:
+  Recorder();
+
+  /**
+   * @return Small index of the calling thread. mMutex must be held.
+   */
+  int _getThreadIdx();
+
+  // Bounds the memory of a trace left running
+  static constexpr size_t mMaxEvents = 1 << 16;
+
+  const std::chrono::steady_clock::time_point mEpoch;
+
+  mutable std::mutex mMutex;
+  std::vector<Event> mEvents;
+  std::vector<StageTotals> mTotals;
+  std::vector<std::thread::id> mThreadIds;
+};
+
+/**
+ * Record the time from construction to destruction as an event of a stage,
+ * with the bytes and frames added meanwhile.
+ */
+class Scope {
+public:
+  /**
+   * @param inName Stage name, must outlive the recorder (string literal).
+   */
+  explicit Scope(const char *inName)
+      : mRecorder(Recorder::get()), mName(inName),
+        mBegin(std::chrono::steady_clock::now()) {}
+
+  ~Scope() {
+    mRecorder.record(mName, mBegin, std::chrono::steady_clock::now(), mBytes,
+                     mFrames);
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+  void addBytes(int64_t inBytes) { mBytes += inBytes; }
+
+  void addFrames(int64_t inFrames) { mFrames += inFrames; }
+
+private:
+  // Created before mBegin, which is never before the recorder epoch
+  Recorder &mRecorder;
+  const char *mName;
+  std::chrono::steady_clock::time_point mBegin;
+  int64_t mBytes = 0;
+  int64_t mFrames = 0;
+};
+
+/**
+ * Record bytes and frames of a stage outside of a scope.
+ * @param inName Stage name, must outlive the recorder (string literal).
+ * @param inBytes Bytes allocated
+ * @param inFrames Frames processed
+ */
+inline void count(const char *inName, int64_t inBytes, int64_t inFrames) {
+  const auto now = std::chrono::steady_clock::now();
+  Recorder::get().record(inName, now, now, inBytes, inFrames);
+}
+
+} // namespace Trace
+
+#if SAMPLE2MIDI_TRACE
+#define TRACE_SCOPE(scope, name) Trace::Scope scope(name)
+#define TRACE_BYTES(scope, bytes) scope.addBytes(static_cast<int64_t>(bytes))
+#define TRACE_FRAMES(scope, frames)                                            \
+  scope.addFrames(static_cast<int64_t>(frames))
+#define TRACE_COUNT(name, bytes, frames)                                       \
+  Trace::count(name, static_cast<int64_t>(bytes), static_cast<int64_t>(frames))
+#else
+#define TRACE_SCOPE(scope, name)
+#define TRACE_BYTES(scope, bytes)
+#define TRACE_FRAMES(scope, frames)
+#define TRACE_COUNT(name, bytes, frames)
+#endif
+
+#endif // Trace_h
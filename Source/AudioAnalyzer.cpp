@@ -1,4 +1,5 @@
 #include "AudioAnalyzer.h"
+#include <algorithm>
 #include <cmath>
 
 AudioAnalyzer::AudioAnalyzer() {}
@@ -7,18 +8,19 @@ AudioAnalyzer::~AudioAnalyzer() {}
 std::vector<DetectedNote> AudioAnalyzer::analyze(const juce::AudioBuffer<float>& buffer, double sampleRate)
 {
     std::vector<DetectedNote> notes;
-    int windowSize = 2048;
-    int hopSize = 512;
     int numSamples = buffer.getNumSamples();
     const float* data = buffer.getReadPointer(0); // Analyze first channel
 
+    const auto framePitches = detectFramePitches(data, numSamples, sampleRate);
+
     int currentNote = -1;
     double noteStartTime = 0;
     float peakVelocity = 0;
 
-    for (int i = 0; i < numSamples - windowSize; i += hopSize)
+    for (size_t frame = 0; frame < framePitches.size(); ++frame)
     {
-        float freq = detectPitch(data + i, windowSize, sampleRate);
+        const int i = (int)frame * hopSize;
+        float freq = framePitches[frame];
         if (freq > 0)
         {
             int midi = (int)std::round(12.0 * std::log2(freq / 440.0) + 69.0);
@@ -49,26 +51,77 @@ std::vector<DetectedNote> AudioAnalyzer::analyze(const juce::AudioBuffer<float>&
     return notes;
 }
 
+std::vector<float> AudioAnalyzer::detectFramePitches(const float* data, int numSamples, double sampleRate)
+{
+    std::vector<float> pitches;
+
+    if (numSamples <= windowSize)
+        return pitches;
+
+    pitches.reserve((size_t)((numSamples - windowSize + hopSize - 1) / hopSize));
+
+    prepareFFT(windowSize, (int)(sampleRate / 50.0));
+
+    for (int i = 0; i < numSamples - windowSize; i += hopSize)
+        pitches.push_back(detectPitch(data + i, windowSize, sampleRate));
+
+    return pitches;
+}
+
+void AudioAnalyzer::prepareFFT(int numSamples, int maxPeriod)
+{
+    // Zero padding to numSamples + maxPeriod: the circular autocorrelation
+    // does not wrap for the lags searched
+    int order = 0;
+    while ((1 << order) < numSamples + maxPeriod)
+        ++order;
+
+    if (order == fftOrder)
+        return;
+
+    fftOrder = order;
+    fft = std::make_unique<juce::dsp::FFT>(order);
+    fftBuffer.assign((size_t)(2 << order), 0.0f);
+}
+
 float AudioAnalyzer::detectPitch(const float* data, int numSamples, double sampleRate)
 {
-    // Simple Autocorrelation
+    // Autocorrelation r(period) = sum data[i] * data[i + period], computed as
+    // the inverse FFT of the power spectrum
     int minPeriod = (int)(sampleRate / 1000.0); // 1000Hz max
     int maxPeriod = (int)(sampleRate / 50.0);   // 50Hz min
-    
+
+    prepareFFT(numSamples, maxPeriod);
+
+    const int fftSize = 1 << fftOrder;
+    float* spectrum = fftBuffer.data();
+
+    std::copy(data, data + numSamples, spectrum);
+    std::fill(spectrum + numSamples, spectrum + 2 * fftSize, 0.0f);
+
+    fft->performRealOnlyForwardTransform(spectrum, true);
+
+    // Power spectrum of the non-negative frequencies. Plain loop over
+    // contiguous data, vectorized by the compiler.
+    for (int k = 0; k <= fftSize / 2; ++k)
+    {
+        const float re = spectrum[2 * k];
+        const float im = spectrum[2 * k + 1];
+        spectrum[2 * k] = re * re + im * im;
+        spectrum[2 * k + 1] = 0.0f;
+    }
+
+    fft->performRealOnlyInverseTransform(spectrum);
+
+    const float* correlation = spectrum;
     float maxCorrelation = 0;
     int bestPeriod = -1;
 
     for (int period = minPeriod; period < maxPeriod; ++period)
     {
-        float correlation = 0;
-        for (int i = 0; i < numSamples - period; ++i)
-        {
-            correlation += data[i] * data[i + period];
-        }
-
-        if (correlation > maxCorrelation)
+        if (correlation[period] > maxCorrelation)
         {
-            maxCorrelation = correlation;
+            maxCorrelation = correlation[period];
             bestPeriod = period;
         }
     }
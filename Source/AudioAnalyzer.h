@@ -2,6 +2,9 @@
 
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_dsp/juce_dsp.h>
+#include <memory>
+#include <vector>
 
 struct DetectedNote
 {
@@ -20,5 +23,19 @@ public:
     std::vector<DetectedNote> analyze(const juce::AudioBuffer<float>& buffer, double sampleRate);
 
 private:
+    // Pitch of each hop, all frames computed with the same FFT plan
+    std::vector<float> detectFramePitches(const float* data, int numSamples, double sampleRate);
+
     float detectPitch(const float* data, int numSamples, double sampleRate);
+
+    // Allocate the FFT plan and buffers for windows of numSamples samples
+    // and lags up to maxPeriod (no-op if already done)
+    void prepareFFT(int numSamples, int maxPeriod);
+
+    static constexpr int windowSize = 2048;
+    static constexpr int hopSize = 512;
+
+    int fftOrder = -1;
+    std::unique_ptr<juce::dsp::FFT> fft;
+    std::vector<float> fftBuffer; // 2 * fft size
 };
@@ -1,4 +1,5 @@
 #pragma once
+#include "SampleStore.h"
 #include <functional>
 #include <juce_audio_formats/juce_audio_formats.h>
 #include <juce_gui_basics/juce_gui_basics.h>
@@ -6,19 +7,25 @@
 /**
  * AudioFileLoader
  *
- * Loads an audio file on a background juce::Thread so the message thread is
- * never blocked.  When loading is complete the supplied callback is invoked on
- * the message thread via juce::MessageManager::callAsync.
+ * Opens an audio file as a SampleStore on a background juce::Thread so the
+ * message thread is never blocked (PCM files are memory mapped, other formats
+ * decoded).  When loading is complete the supplied callback is invoked on the
+ * message thread via juce::MessageManager::callAsync.
+ *
+ * Compressed files are decoded block by block into the store on the loader
+ * thread.  The optional open callback receives the store as soon as the file
+ * is opened, before decoding, so that its samples can be consumed while the
+ * rest of the file is decoded.
  *
  * Usage:
  *   loader = std::make_unique<AudioFileLoader>();
  *   loader->loadAsync(file, formatManager,
- *       [](juce::AudioBuffer<float> buf, double sr) { ... });
+ *       [](std::shared_ptr<const SampleStore> store) { ... });
  */
 class AudioFileLoader : public juce::Thread {
 public:
   using LoadCallback =
-      std::function<void(juce::AudioBuffer<float>, double sampleRate)>;
+      std::function<void(std::shared_ptr<const SampleStore> store)>;
 
   AudioFileLoader() : juce::Thread("AudioFileLoader") {}
 
@@ -29,17 +36,20 @@ public:
    *  @param formatManager  A registered AudioFormatManager (must outlive this
    * call).
    *  @param onComplete     Called on the message thread when loading finishes.
-   *                        Receives an empty buffer on failure.
+   *                        Receives nullptr on failure.
+   *  @param onOpened       Called on the message thread when the file is
+   *                        opened, before decoding. Not called on failure.
    */
   void loadAsync(const juce::File &file,
                  juce::AudioFormatManager &formatManager,
-                 LoadCallback onComplete) {
+                 LoadCallback onComplete, LoadCallback onOpened = nullptr) {
     // Stop any previous load
     stopThread(4000);
 
     pendingFile = file;
     pendingManager = &formatManager;
     completionCallback = std::move(onComplete);
+    openedCallback = std::move(onOpened);
 
     startThread();
   }
@@ -71,36 +81,39 @@ public:
 
 private:
   void run() override {
-    juce::AudioBuffer<float> resultBuffer;
-    double resultSampleRate = 0.0;
-
-    if (pendingManager != nullptr) {
-      std::unique_ptr<juce::AudioFormatReader> reader(
-          pendingManager->createReaderFor(pendingFile));
+    std::shared_ptr<SampleStore> store;
 
-      if (reader != nullptr) {
-        resultSampleRate = reader->sampleRate;
-        const int numChannels = (int)reader->numChannels;
-        const int numSamples = (int)reader->lengthInSamples;
+    if (pendingManager != nullptr)
+      store = SampleStore::open(pendingFile, *pendingManager);
 
-        resultBuffer.setSize(numChannels, numSamples);
-        reader->read(&resultBuffer, 0, numSamples, 0, true, true);
+    if (store != nullptr) {
+      if (openedCallback) {
+        auto opened = openedCallback;
+        std::shared_ptr<const SampleStore> openedStore = store;
+        juce::MessageManager::callAsync(
+            [opened, openedStore]() { opened(openedStore); });
       }
+
+      // Readers of the store get the samples as they are decoded. A load
+      // superseded by another one stops here.
+      store->decode([this] { return threadShouldExit(); });
+      if (threadShouldExit())
+        return;
     }
 
     // Marshal result back to the message thread
     auto callback = completionCallback;
-    juce::MessageManager::callAsync([callback,
-                                     resultBuffer = std::move(resultBuffer),
-                                     resultSampleRate]() mutable {
+    std::shared_ptr<const SampleStore> loadedStore = store;
+    juce::MessageManager::callAsync([callback, loadedStore]() {
       if (callback)
-        callback(std::move(resultBuffer), resultSampleRate);
+        callback(loadedStore);
     });
   }
 
   juce::File pendingFile;
   juce::AudioFormatManager *pendingManager = nullptr;
   LoadCallback completionCallback;
+  LoadCallback openedCallback;
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioFileLoader)
 };
@@ -0,0 +1,95 @@
+#include "KeyDetector.h"
+#include <cmath>
+
+namespace {
+
+// Krumhansl-Schmuckler key profiles, tonic first
+constexpr double kMajorProfile[12] = {6.35, 2.23, 3.48, 2.33, 4.38, 4.09,
+                                      2.52, 5.19, 2.39, 3.66, 2.29, 2.88};
+constexpr double kMinorProfile[12] = {6.33, 2.68, 3.52, 5.38, 2.60, 3.53,
+                                      2.54, 4.75, 3.98, 2.69, 3.34, 3.17};
+
+// Subtract the mean of values and scale them to unit norm. Returns false if
+// values are all equal.
+bool centreAndNormalize(const double *values, float *output) {
+  double mean = 0.0;
+  for (int j = 0; j < 12; ++j)
+    mean += values[j] / 12.0;
+
+  double norm = 0.0;
+  for (int j = 0; j < 12; ++j)
+    norm += (values[j] - mean) * (values[j] - mean);
+  norm = std::sqrt(norm);
+
+  if (!(norm > 1e-9 * std::abs(mean)))
+    return false;
+
+  for (int j = 0; j < 12; ++j)
+    output[j] = (float)((values[j] - mean) / norm);
+
+  return true;
+}
+
+} // namespace
+
+juce::String KeyDetector::Key::getName() const {
+  static const char *rootNames[] = {"C",  "C#", "D",  "D#", "E",  "F",
+                                    "F#", "G",  "G#", "A",  "A#", "B"};
+  return juce::String(rootNames[root]) + (isMinor ? " Minor" : " Major");
+}
+
+const std::array<std::array<float, 12>, KeyDetector::kNumKeys> &
+KeyDetector::getKeyProfiles() {
+  static const auto profiles = [] {
+    std::array<std::array<float, 12>, kNumKeys> table{};
+
+    for (int key = 0; key < kNumKeys; ++key) {
+      const double *profile = key < 12 ? kMajorProfile : kMinorProfile;
+      const int root = key % 12;
+
+      double rotated[12];
+      for (int j = 0; j < 12; ++j)
+        rotated[j] = profile[(j - root + 12) % 12];
+
+      centreAndNormalize(rotated, table[(size_t)key].data());
+    }
+
+    return table;
+  }();
+
+  return profiles;
+}
+
+std::optional<KeyDetector::Key>
+KeyDetector::detect(const std::array<float, 12> &profile) {
+  double values[12];
+  for (int j = 0; j < 12; ++j)
+    values[j] = profile[(size_t)j];
+
+  float input[12];
+  if (!centreAndNormalize(values, input))
+    return std::nullopt;
+
+  const auto &keyProfiles = getKeyProfiles();
+  float correlations[kNumKeys];
+
+  for (int key = 0; key < kNumKeys; ++key) {
+    const float *row = keyProfiles[(size_t)key].data();
+    float dot = 0.0f;
+    for (int j = 0; j < 12; ++j)
+      dot += row[j] * input[j];
+    correlations[key] = dot;
+  }
+
+  // First maximum: majors win ties, as do lower roots
+  int best = 0;
+  for (int key = 1; key < kNumKeys; ++key)
+    if (correlations[key] > correlations[best])
+      best = key;
+
+  Key result;
+  result.root = best % 12;
+  result.isMinor = best >= 12;
+  result.correlation = correlations[best];
+  return result;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <juce_core/juce_core.h>
+#include <optional>
+
+// Major / minor key estimation from a pitch class profile.
+//
+// The profile is correlated with the 24 rotations of the Krumhansl-Schmuckler
+// major and minor key profiles. The rotated profiles are centred and
+// normalized once, so the Pearson correlation with each key is a 12 element
+// dot product: the 24 correlations are one pass over a contiguous 24 x 12
+// table.
+class KeyDetector {
+public:
+  struct Key {
+    int root = 0; // Pitch class, C = 0
+    bool isMinor = false;
+    float correlation = 0.0f;
+
+    // E.g. "A Minor"
+    juce::String getName() const;
+  };
+
+  // Best key for a pitch class profile (C first, any non-negative weights).
+  // Empty if the profile is flat.
+  static std::optional<Key> detect(const std::array<float, 12> &profile);
+
+private:
+  static constexpr int kNumKeys = 24; // 12 major then 12 minor
+
+  // Centred and normalized key profiles, row k is key k
+  static const std::array<std::array<float, 12>, kNumKeys> &getKeyProfiles();
+};
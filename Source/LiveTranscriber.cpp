@@ -0,0 +1,448 @@
+#include "LiveTranscriber.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+LiveTranscriber::LiveTranscriber() : juce::Thread("LiveTranscriber") {
+  stepNotes.resize((size_t)kStepFrames * NUM_FREQ_OUT);
+  stepOnsets.resize((size_t)kStepFrames * NUM_FREQ_OUT);
+}
+
+LiveTranscriber::~LiveTranscriber() { release(); }
+
+void LiveTranscriber::prepare(double sampleRate, int maximumBlockSize) {
+  release();
+
+  hostSampleRate = sampleRate;
+  maxBlockSize = juce::jmax(1, maximumBlockSize);
+
+  resampler.prepare(hostSampleRate, BASIC_PITCH_SAMPLE_RATE);
+
+  const int inputFifoSize =
+      juce::jmax((int)(kInputFifoSeconds * hostSampleRate), 4 * maxBlockSize);
+  inputFifo.setTotalSize(inputFifoSize);
+  inputBuffer.assign((size_t)inputFifoSize, 0.0f);
+  downmixBuffer.assign((size_t)maxBlockSize, 0.0f);
+
+  // Window of the features plus one block of resampled input
+  const int windowFrames =
+      kLeftContextFrames + kStepFrames + kRightContextFrames + 1;
+  audio.assign((size_t)(windowFrames * FFT_HOP +
+                        resampler.getMaxOutputSamples(kReadBlockSize)),
+               0.0f);
+
+  latencySamples = computeLatencySamples();
+  prepared = true;
+
+  if (enabled)
+    start();
+}
+
+void LiveTranscriber::release() {
+  running.store(false, std::memory_order_release);
+  stopThread(2000);
+}
+
+void LiveTranscriber::setEnabled(bool shouldBeEnabled) {
+  if (enabled == shouldBeEnabled)
+    return;
+
+  enabled = shouldBeEnabled;
+
+  if (!shouldBeEnabled) {
+    release();
+  } else if (prepared) {
+    stopThread(2000);
+    start();
+  }
+}
+
+void LiveTranscriber::setParameters(float noteSensitivity,
+                                    float splitSensitivity) {
+  frameThreshold = 1.0f - noteSensitivity;
+  onsetThreshold = 1.0f - splitSensitivity;
+}
+
+int LiveTranscriber::computeLatencySamples() const {
+  // Frames needed after a frame before its events are known: the rest of its
+  // step, the features lookahead, the CNN lookahead and one frame to detect
+  // onset peaks.
+  const int numFrames = kStepFrames + kRightContextFrames +
+                        BasicPitchCNN::getNumFramesLookahead() + 1;
+  const double frameSeconds = FFT_HOP / BASIC_PITCH_SAMPLE_RATE;
+  const double marginSeconds =
+      kStepCostMargin * stepSeconds + kPollIntervalMs / 1000.0;
+
+  return (int)std::ceil((numFrames * frameSeconds + marginSeconds) *
+                        hostSampleRate) +
+         resampler.getLookahead() + maxBlockSize;
+}
+
+void LiveTranscriber::start() {
+  // The step cost does not depend on the host: measured once
+  if (features == nullptr) {
+    features =
+        std::make_unique<Features>(PitchDetector::getFeaturesSessionParams());
+    stepSeconds = measureStepSeconds();
+  }
+
+  latencySamples = computeLatencySamples();
+  resetStream();
+  running.store(true, std::memory_order_release);
+  startThread();
+}
+
+double LiveTranscriber::measureStepSeconds() {
+  const int windowSize =
+      (kLeftContextFrames + kStepFrames + kRightContextFrames) * FFT_HOP;
+  jassert(windowSize <= (int)audio.size());
+
+  juce::Random random(1);
+  for (int i = 0; i < windowSize; ++i)
+    audio[(size_t)i] = 0.1f * (2.0f * random.nextFloat() - 1.0f);
+
+  // The first run is not timed: it includes one-off allocations
+  double worstSeconds = 0.0;
+  for (int i = 0; i <= kNumMeasuredSteps; ++i) {
+    const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+    size_t numFrames = 0;
+    const float *frames =
+        features->computeFeatures(audio.data(), (size_t)windowSize, numFrames);
+    jassert(numFrames >= (size_t)kStepFrames);
+    cnn.batchInference(frames, kStepFrames, nullptr, stepNotes.data(),
+                       stepOnsets.data());
+
+    const double seconds =
+        (juce::Time::getMillisecondCounterHiRes() - startMs) / 1000.0;
+    if (i > 0)
+      worstSeconds = juce::jmax(worstSeconds, seconds);
+  }
+
+  cnn.reset();
+  return worstSeconds;
+}
+
+// ---------------------------------------------------------------------------
+// Audio thread
+// ---------------------------------------------------------------------------
+
+void LiveTranscriber::process(const juce::AudioBuffer<float> &buffer,
+                              int numInputChannels,
+                              juce::MidiBuffer &midiMessages) {
+  if (!running.load(std::memory_order_acquire)) {
+    releaseSoundingNotes(midiMessages, 0);
+    return;
+  }
+
+  const int numSamples = buffer.getNumSamples();
+  const int numChannels = juce::jmin(numInputChannels, buffer.getNumChannels());
+
+  // Downmix and hand the input over to the worker. Samples which do not fit
+  // are dropped (the worker is not keeping up), and so is the input until the
+  // worker has caught up: the stream then restarts at the current sample, so
+  // that events keep their fixed latency.
+  for (int offset = 0; offset < numSamples;) {
+    const int num = juce::jmin(numSamples - offset, (int)downmixBuffer.size());
+    float *mono = downmixBuffer.data();
+
+    if (overrun) {
+      if (inputFifo.getNumReady() > 0) {
+        offset += num;
+        continue;
+      }
+
+      resumePosition.store(numSamplesProcessed + offset,
+                           std::memory_order_relaxed);
+      resumePending.store(true, std::memory_order_release);
+      overrun = false;
+    }
+
+    if (numChannels == 0) {
+      juce::FloatVectorOperations::clear(mono, num);
+    } else {
+      juce::FloatVectorOperations::copy(mono, buffer.getReadPointer(0, offset),
+                                        num);
+      for (int ch = 1; ch < numChannels; ++ch)
+        juce::FloatVectorOperations::add(
+            mono, buffer.getReadPointer(ch, offset), num);
+      if (numChannels > 1)
+        juce::FloatVectorOperations::multiply(mono, 1.0f / numChannels, num);
+    }
+
+    int start1, size1, start2, size2;
+    inputFifo.prepareToWrite(num, start1, size1, start2, size2);
+    std::copy(mono, mono + size1, inputBuffer.data() + start1);
+    std::copy(mono + size1, mono + size1 + size2,
+              inputBuffer.data() + start2);
+    inputFifo.finishedWrite(size1 + size2);
+
+    if (size1 + size2 < num)
+      overrun = true;
+
+    offset += num;
+  }
+
+  // Events due in this block
+  const int64_t latency = latencySamples;
+  int start1, size1, start2, size2;
+  eventFifo.prepareToRead(eventFifo.getNumReady(), start1, size1, start2,
+                          size2);
+
+  int numRead = 0;
+  for (int i = 0; i < size1 + size2; ++i) {
+    const auto &event =
+        eventBuffer[(size_t)(i < size1 ? start1 + i : start2 + i - size1)];
+    const int64_t position =
+        event.samplePosition + latency - numSamplesProcessed;
+
+    if (position >= numSamples)
+      break;
+
+    // Late events (worker behind) are sent at the start of the block
+    const int samplePosition = (int)juce::jmax<int64_t>(position, 0);
+    auto &sounding = soundingNotes[(size_t)event.noteNumber];
+
+    if (event.velocity > 0.0f) {
+      if (sounding)
+        midiMessages.addEvent(juce::MidiMessage::noteOff(1, event.noteNumber),
+                              samplePosition);
+      midiMessages.addEvent(
+          juce::MidiMessage::noteOn(1, event.noteNumber, event.velocity),
+          samplePosition);
+      sounding = true;
+    } else if (sounding) {
+      midiMessages.addEvent(juce::MidiMessage::noteOff(1, event.noteNumber),
+                            samplePosition);
+      sounding = false;
+    }
+
+    ++numRead;
+  }
+  eventFifo.finishedRead(numRead);
+
+  numSamplesProcessed += numSamples;
+}
+
+void LiveTranscriber::releaseSoundingNotes(juce::MidiBuffer &midiMessages,
+                                           int position) {
+  for (int note = 0; note < (int)soundingNotes.size(); ++note) {
+    if (soundingNotes[(size_t)note]) {
+      midiMessages.addEvent(juce::MidiMessage::noteOff(1, note), position);
+      soundingNotes[(size_t)note] = false;
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Worker thread
+// ---------------------------------------------------------------------------
+
+void LiveTranscriber::resetStream() {
+  // Called while neither the worker nor process() use the FIFOs
+  inputFifo.reset();
+  eventFifo.reset();
+  numSamplesProcessed = 0;
+  overrun = false;
+  resumePending = false;
+
+  resampler.reset();
+  cnn.reset();
+  streamStart = 0;
+  numAudio = 0;
+  audioStart = 0;
+  nextFrame = 0;
+
+  numTrackedFrames = 0;
+  pitchStates.fill(PitchState{});
+  numActiveNotes = 0;
+}
+
+void LiveTranscriber::resyncStream(int64_t position) {
+  for (int p = 0; p < NUM_FREQ_OUT; ++p)
+    if (pitchStates[(size_t)p].active)
+      pushNoteOff(lastTrackedFrame, p + MIDI_OFFSET);
+
+  resampler.reset();
+  cnn.reset();
+  streamStart = position;
+  numAudio = 0;
+  audioStart = 0;
+  nextFrame = 0;
+
+  numTrackedFrames = 0;
+  pitchStates.fill(PitchState{});
+}
+
+void LiveTranscriber::run() {
+  while (!threadShouldExit()) {
+    int start1, size1, start2, size2;
+    inputFifo.prepareToRead(juce::jmin(inputFifo.getNumReady(), kReadBlockSize),
+                            start1, size1, start2, size2);
+
+    if (size1 + size2 == 0) {
+      wait(kPollIntervalMs);
+      continue;
+    }
+
+    // Input written after an overrun: all the input before the gap has been
+    // read, as the audio thread only resumes once the FIFO is empty
+    if (resumePending.exchange(false, std::memory_order_acquire))
+      resyncStream(resumePosition.load(std::memory_order_relaxed));
+
+    pushInput(inputBuffer.data() + start1, size1);
+    if (size2 > 0)
+      pushInput(inputBuffer.data() + start2, size2);
+
+    inputFifo.finishedRead(size1 + size2);
+  }
+}
+
+void LiveTranscriber::pushInput(const float *samples, int numSamples) {
+  jassert(numAudio + resampler.getMaxOutputSamples(numSamples) <=
+          (int)audio.size());
+
+  numAudio +=
+      resampler.process(&samples, 1, numSamples, audio.data() + numAudio);
+
+  // A step needs its frames plus the right context
+  while (audioStart + numAudio >=
+             (nextFrame + kStepFrames + kRightContextFrames) * FFT_HOP &&
+         !threadShouldExit())
+    processStep();
+}
+
+void LiveTranscriber::processStep() {
+  const int64_t segmentStartFrame =
+      juce::jmax<int64_t>(0, nextFrame - kLeftContextFrames);
+  const int64_t segmentStart = segmentStartFrame * FFT_HOP;
+  const int64_t segmentEnd =
+      (nextFrame + kStepFrames + kRightContextFrames) * FFT_HOP;
+
+  jassert(segmentStart >= audioStart &&
+          segmentEnd <= audioStart + numAudio);
+
+  size_t numFrames = 0;
+  const float *frames = features->computeFeatures(
+      audio.data() + (segmentStart - audioStart),
+      (size_t)(segmentEnd - segmentStart), numFrames);
+
+  const auto localFrame = (size_t)(nextFrame - segmentStartFrame);
+  jassert(localFrame + kStepFrames <= numFrames);
+  juce::ignoreUnused(numFrames);
+
+  cnn.batchInference(frames + localFrame * NUM_HARMONICS * NUM_FREQ_IN,
+                     kStepFrames, nullptr, stepNotes.data(),
+                     stepOnsets.data());
+
+  // CNN outputs are delayed by its lookahead
+  for (int i = 0; i < kStepFrames; ++i) {
+    const int64_t frame =
+        nextFrame + i - BasicPitchCNN::getNumFramesLookahead();
+    if (frame >= 0)
+      trackFrame(frame, stepNotes.data() + i * NUM_FREQ_OUT,
+                 stepOnsets.data() + i * NUM_FREQ_OUT);
+  }
+
+  nextFrame += kStepFrames;
+
+  // Only keep the left context of the next step
+  const int64_t newStart =
+      juce::jmax<int64_t>(0, nextFrame - kLeftContextFrames) * FFT_HOP;
+  const int numDropped = (int)(newStart - audioStart);
+
+  if (numDropped > 0) {
+    std::memmove(audio.data(), audio.data() + numDropped,
+                 (size_t)(numAudio - numDropped) * sizeof(float));
+    numAudio -= numDropped;
+    audioStart = newStart;
+  }
+}
+
+void LiveTranscriber::trackFrame(int64_t frame, const float *notes,
+                                 const float *onsets) {
+  // Frame frame - 1 is decided now that the onsets of the next frame are known
+  if (numTrackedFrames > 0) {
+    const int64_t t = frame - 1;
+    const float onsetThresh = onsetThreshold;
+    const float frameThresh = frameThreshold;
+
+    for (int p = 0; p < NUM_FREQ_OUT; ++p) {
+      const float onset = lastOnsets[(size_t)p];
+      const float previous =
+          numTrackedFrames > 1 ? previousOnsets[(size_t)p] : onset;
+      const float note = lastNotes[(size_t)p];
+      const float energy = std::max(note, notes[p]);
+
+      const bool isOnset = onset >= onsetThresh && onset >= previous &&
+                           onset >= onsets[p] && energy >= frameThresh;
+
+      auto &state = pitchStates[(size_t)p];
+      const int noteNumber = p + MIDI_OFFSET;
+
+      if (state.active) {
+        if (isOnset && t - state.startFrame >= kMinRetriggerFrames) {
+          pushNoteOff(t, noteNumber);
+          state.active = pushNoteOn(t, noteNumber, energy);
+          state.startFrame = t;
+          state.numFramesBelow = 0;
+        } else if (note < frameThresh) {
+          if (++state.numFramesBelow >= kNoteOffFrames) {
+            pushNoteOff(t, noteNumber);
+            state.active = false;
+          }
+        } else {
+          state.numFramesBelow = 0;
+        }
+      } else if (isOnset && pushNoteOn(t, noteNumber, energy)) {
+        state.active = true;
+        state.startFrame = t;
+        state.numFramesBelow = 0;
+      }
+    }
+  }
+
+  lastTrackedFrame = frame;
+  previousOnsets = lastOnsets;
+  std::copy(onsets, onsets + NUM_FREQ_OUT, lastOnsets.begin());
+  std::copy(notes, notes + NUM_FREQ_OUT, lastNotes.begin());
+  ++numTrackedFrames;
+}
+
+bool LiveTranscriber::pushNoteOn(int64_t frame, int noteNumber,
+                                 float velocity) {
+  // Dropped if the audio thread is not reading (e.g. host stopped). The note
+  // on and the note off of the note must fit besides the note offs of the
+  // active notes.
+  if (eventFifo.getFreeSpace() < numActiveNotes + 2)
+    return false;
+
+  pushEvent(frame, noteNumber, velocity);
+  ++numActiveNotes;
+  return true;
+}
+
+void LiveTranscriber::pushNoteOff(int64_t frame, int noteNumber) {
+  jassert(numActiveNotes > 0 && eventFifo.getFreeSpace() >= numActiveNotes);
+
+  pushEvent(frame, noteNumber, 0.0f);
+  --numActiveNotes;
+}
+
+void LiveTranscriber::pushEvent(int64_t frame, int noteNumber,
+                                float velocity) {
+  NoteEvent event;
+  event.samplePosition =
+      streamStart +
+      (int64_t)std::llround((double)(frame * FFT_HOP) * hostSampleRate /
+                            BASIC_PITCH_SAMPLE_RATE);
+  event.noteNumber = noteNumber;
+  event.velocity =
+      velocity > 0.0f ? juce::jlimit(1.0f / 127.0f, 1.0f, velocity) : 0.0f;
+
+  int start1, size1, start2, size2;
+  eventFifo.prepareToWrite(1, start1, size1, start2, size2);
+  if (size1 > 0)
+    eventBuffer[(size_t)start1] = event;
+  eventFifo.finishedWrite(size1);
+}
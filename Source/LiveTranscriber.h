@@ -0,0 +1,206 @@
+#pragma once
+
+#include "BasicPitchCNN.h"
+#include "BasicPitchConstants.h"
+#include "Features.h"
+#include "PitchDetector.h"
+#include "PolyphaseResampler.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_core/juce_core.h>
+#include <memory>
+#include <vector>
+
+/**
+ * LiveTranscriber
+ *
+ * Streaming transcription of the host input to MIDI with a fixed latency.
+ *
+ * The audio thread only downmixes its input into a lock-free FIFO and copies
+ * the note events that are due from a second FIFO into the MidiBuffer. A
+ * worker thread does the rest incrementally:
+ *   - resampling to 22050 Hz with the streaming PolyphaseResampler,
+ *   - features (CQT + harmonic stacking) of kStepFrames new frames at a time,
+ *     computed on a short window of kLeftContextFrames of past audio and
+ *     kRightContextFrames of lookahead,
+ *   - the basic pitch CNN, run continuously on the new frames,
+ *   - a streaming note tracker: a note starts on an onset peak above the
+ *     onset threshold and ends when the note posteriorgram stays below the
+ *     frame threshold.
+ *
+ * Events are timestamped at the input sample they were detected at and played
+ * getLatencySamples() later, which the processor reports to the host. The
+ * latency includes a margin derived from the cost of a step, measured when
+ * live transcription starts.
+ *
+ * Usage:
+ *   prepare() from prepareToPlay, setEnabled() from the message thread,
+ *   process() from processBlock.
+ */
+class LiveTranscriber : private juce::Thread {
+public:
+  LiveTranscriber();
+  ~LiveTranscriber() override;
+
+  /** Allocate for the host sample rate and block size. Restarts the worker if
+   *  live transcription is enabled. Not to be called concurrently with
+   *  process(). The features model is only loaded once live transcription is
+   *  enabled. */
+  void prepare(double sampleRate, int maximumBlockSize);
+
+  /** Stop the worker, keeping the enabled state for the next prepare(). */
+  void release();
+
+  /** Start or stop live transcription (message thread). */
+  void setEnabled(bool shouldBeEnabled);
+  bool isEnabled() const { return enabled; }
+
+  /** Same meaning as BasicPitch::setParameters. Can be called at any time. */
+  void setParameters(float noteSensitivity, float splitSensitivity);
+
+  /** Fixed delay between the input and the MIDI events, in host samples.
+   *  Updated by prepare() and setEnabled(). */
+  int getLatencySamples() const { return latencySamples; }
+
+  /** Audio thread: push the first numInputChannels channels of buffer and add
+   *  the note events due in this block to midiMessages. */
+  void process(const juce::AudioBuffer<float> &buffer, int numInputChannels,
+               juce::MidiBuffer &midiMessages);
+
+private:
+  struct NoteEvent {
+    int64_t samplePosition; // Input sample the event was detected at
+    int noteNumber;
+    float velocity; // 0 for note off
+  };
+
+  struct PitchState {
+    bool active = false;
+    int64_t startFrame = 0;
+    int numFramesBelow = 0;
+  };
+
+  void run() override;
+
+  int computeLatencySamples() const;
+
+  // Load the features model on first use, measure the step cost, then start
+  // the worker on a new stream
+  void start();
+
+  // Worst time taken by the features and CNN of a step, in seconds. Run
+  // before the worker starts, on its buffers.
+  double measureStepSeconds();
+
+  // Worker: restart the stream (resampler, features window, CNN, tracker)
+  void resetStream();
+
+  // Worker: restart the stream at host sample position after an input
+  // overrun, ending the active notes at the last frame before the gap
+  void resyncStream(int64_t position);
+
+  // Worker: resample input samples into the features window
+  void pushInput(const float *samples, int numSamples);
+
+  // Worker: features and CNN of the next kStepFrames frames
+  void processStep();
+
+  // Worker: note tracking of CNN output frame, called once per frame
+  void trackFrame(int64_t frame, const float *notes, const float *onsets);
+
+  // Worker: queue a note on, unless the event FIFO only has room left for
+  // the note offs of the active notes. Returns false if the note on was
+  // dropped, in which case the note is not active.
+  bool pushNoteOn(int64_t frame, int noteNumber, float velocity);
+
+  // Worker: queue the note off of an active note. Always fits: pushNoteOn
+  // keeps room for the note off of every active note.
+  void pushNoteOff(int64_t frame, int noteNumber);
+
+  void pushEvent(int64_t frame, int noteNumber, float velocity);
+
+  // Audio thread: note offs for all sounding notes
+  void releaseSoundingNotes(juce::MidiBuffer &midiMessages, int position);
+
+  // Frames transcribed per step. Each step runs the features model on its
+  // whole window, context included: ~13 frames are computed per new frame.
+  static constexpr int kStepFrames = 4;
+  // Past audio given to the features model, ~0.5 s. Shorter than the ~2 s
+  // Features::mNumContextFrames of offline runs, which would cost ~45 frames
+  // per new frame: the kernels of the lowest CQT bins are cut, as they are
+  // on the right by kRightContextFrames, and the log CQT is normalized over
+  // a shorter window. Both mostly affect the lowest octave.
+  static constexpr int kLeftContextFrames = 43;
+  static constexpr int kRightContextFrames = 6;
+  // Frames of note posteriorgram below threshold ending a note
+  static constexpr int kNoteOffFrames = 3;
+  // Minimum note length before the same pitch can be re-triggered
+  static constexpr int kMinRetriggerFrames = 6;
+  static constexpr int kReadBlockSize = 1024;
+  static constexpr double kInputFifoSeconds = 2.0;
+  // Latency margin for the time the worker takes to process a step, as a
+  // multiple of the measured step cost. Leaves room for the worker being
+  // preempted.
+  static constexpr double kStepCostMargin = 2.0;
+  static constexpr int kNumMeasuredSteps = 4;
+  // Worker wait when no input is ready, also part of the margin
+  static constexpr int kPollIntervalMs = 5;
+  static constexpr int kEventFifoSize = 1024;
+
+  double hostSampleRate = 44100.0;
+  int maxBlockSize = 0;
+  int latencySamples = 0;
+  double stepSeconds = 0.0;
+  bool prepared = false;
+  std::atomic<bool> enabled{false};
+  std::atomic<bool> running{false};
+
+  std::atomic<float> onsetThreshold{0.5f};
+  std::atomic<float> frameThreshold{0.3f};
+
+  // Audio thread -> worker: downmixed input at the host sample rate
+  juce::AbstractFifo inputFifo{1};
+  std::vector<float> inputBuffer;
+  std::vector<float> downmixBuffer;
+
+  // Worker -> audio thread: note events in time order
+  juce::AbstractFifo eventFifo{kEventFifoSize};
+  std::array<NoteEvent, kEventFifoSize> eventBuffer{};
+
+  // Audio thread state
+  int64_t numSamplesProcessed = 0;
+  std::array<bool, 128> soundingNotes{};
+  // Set when input did not fit in the FIFO. Input is then dropped until the
+  // worker has read all the input written before, and the stream resumes at
+  // resumePosition.
+  bool overrun = false;
+
+  // Audio thread -> worker: the next input read starts at host sample
+  // resumePosition
+  std::atomic<bool> resumePending{false};
+  std::atomic<int64_t> resumePosition{0};
+
+  // Worker state
+  PolyphaseResampler resampler;
+  std::unique_ptr<Features> features; // Created by start()
+  BasicPitchCNN cnn;
+  int64_t streamStart = 0; // Host sample position of frame 0
+  std::vector<float> audio; // 22050 Hz, audio[0] is sample audioStart
+  int numAudio = 0;
+  int64_t audioStart = 0;
+  int64_t nextFrame = 0; // Next frame given to the CNN
+  std::vector<float> stepNotes;
+  std::vector<float> stepOnsets;
+
+  int64_t numTrackedFrames = 0;
+  int64_t lastTrackedFrame = 0;
+  std::array<float, NUM_FREQ_OUT> lastNotes{};
+  std::array<float, NUM_FREQ_OUT> lastOnsets{};
+  std::array<float, NUM_FREQ_OUT> previousOnsets{};
+  std::array<PitchState, NUM_FREQ_OUT> pitchStates{};
+  int numActiveNotes = 0;
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LiveTranscriber)
+};
@@ -1,5 +1,10 @@
 #include "MidiBuilder.h"
+#include "Trace.h"
+#include <cmath>
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
 #include <juce_gui_basics/juce_gui_basics.h>
+#endif
 
 std::vector<MidiNote>
 MidiBuilder::buildNotes(const std::vector<int> &framePitches,
@@ -48,7 +53,10 @@ MidiBuilder::buildNotes(const std::vector<int> &framePitches,
 
 void MidiBuilder::exportMidi(const std::vector<MidiNote> &notes,
                              double sampleRate, const juce::File &file,
-                             float bpm) {
+                             float bpm, double beatOffsetSeconds) {
+  TRACE_SCOPE(scope, "export");
+  TRACE_FRAMES(scope, notes.size());
+
   juce::MidiFile midiFile;
 
   // Add tempo track with detected BPM
@@ -62,9 +70,15 @@ void MidiBuilder::exportMidi(const std::vector<MidiNote> &notes,
   // Ticks per second based on detected BPM
   double ticksPerSecond = 960.0 * (bpm / 60.0);
 
+  // Delay moving the first beat of the audio onto the next quarter note
+  const double beatPeriod = 60.0 / bpm;
+  double gridDelay = beatPeriod - std::fmod(beatOffsetSeconds, beatPeriod);
+  if (gridDelay >= beatPeriod)
+    gridDelay -= beatPeriod;
+
   for (const auto &note : notes) {
-    double startTimeSec = (double)note.startSample / sampleRate;
-    double endTimeSec = (double)note.endSample / sampleRate;
+    double startTimeSec = (double)note.startSample / sampleRate + gridDelay;
+    double endTimeSec = (double)note.endSample / sampleRate + gridDelay;
 
     auto on = juce::MidiMessage::noteOn(
         1, note.noteNumber,
@@ -81,9 +95,11 @@ void MidiBuilder::exportMidi(const std::vector<MidiNote> &notes,
   juce::FileOutputStream stream(file);
   if (stream.openedOk()) {
     midiFile.writeTo(stream, 1);
+    TRACE_BYTES(scope, stream.getPosition());
   }
 }
 
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
 void MidiBuilder::performDragDrop(const std::vector<MidiNote> &notes,
                                   double sampleRate) {
   if (notes.empty())
@@ -103,6 +119,7 @@ void MidiBuilder::performDragDrop(const std::vector<MidiNote> &notes,
         {tempFile.getFullPathName()}, false);
   }
 }
+#endif
 
 std::vector<MidiNote>
 MidiBuilder::quantizeToChords(const std::vector<MidiNote> &notes,
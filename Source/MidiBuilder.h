@@ -17,9 +17,16 @@ public:
   std::vector<MidiNote> buildNotes(const std::vector<int> &framePitches,
                                    const std::vector<float> &frameAmps,
                                    int hopSize, double sampleRate);
+  // beatOffsetSeconds: time of a beat of the audio modulo the beat period.
+  // Notes are delayed by less than a beat so that the beats of the audio fall
+  // on the quarter notes of the file.
   void exportMidi(const std::vector<MidiNote> &notes, double sampleRate,
-                  const juce::File &file, float bpm = 120.0f);
+                  const juce::File &file, float bpm = 120.0f,
+                  double beatOffsetSeconds = 0.0);
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+  // Only in targets linking juce_gui_basics (not the console tools)
   void performDragDrop(const std::vector<MidiNote> &notes, double sampleRate);
+#endif
 
   // Chord mode: quantize notes to chords
   std::vector<MidiNote> quantizeToChords(const std::vector<MidiNote> &notes,
@@ -1,8 +1,57 @@
 #include "PitchDetector.h"
+#include "Trace.h"
 #include <algorithm>
 #include <cmath>
+#include <juce_dsp/juce_dsp.h>
+#include <memory>
 #include <vector>
 
+Features::SessionParams PitchDetector::getFeaturesSessionParams() {
+  const auto cacheDir =
+      juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+          .getChildFile("Sample2MIDI")
+          .getChildFile("ModelCache");
+
+  Features::SessionParams params;
+  params.optimizedModelCacheDir =
+      std::filesystem::u8path(cacheDir.getFullPathName().toStdString());
+  return params;
+}
+
+namespace {
+
+// FFT plan and scratch memory of detectPitch, kept per thread so that
+// concurrent calls are safe and repeated calls do not allocate.
+struct YinScratch {
+  int fftOrder = -1;
+  std::unique_ptr<juce::dsp::FFT> fft;
+  std::vector<float> window;      // 2 * fftSize, FFT of the window
+  std::vector<float> signal;      // 2 * fftSize, FFT of the whole buffer
+  std::vector<double> sumSquares; // Prefix sums of squared samples
+  std::vector<float> yinBuffer;
+};
+
+YinScratch &getYinScratch(int bufferSize, int maxPeriod) {
+  thread_local YinScratch scratch;
+
+  int fftOrder = 0;
+  while ((1 << fftOrder) < bufferSize)
+    ++fftOrder;
+
+  if (scratch.fftOrder != fftOrder) {
+    scratch.fftOrder = fftOrder;
+    scratch.fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+    scratch.window.resize((size_t)(2 << fftOrder));
+    scratch.signal.resize((size_t)(2 << fftOrder));
+  }
+
+  scratch.sumSquares.resize((size_t)bufferSize + 1);
+  scratch.yinBuffer.resize((size_t)maxPeriod + 1);
+  return scratch;
+}
+
+} // namespace
+
 float PitchDetector::detectPitch(const float *buffer, int bufferSize,
                                  double rate) {
   // Simple YIN-like pitch detection for scale detection
@@ -13,15 +62,51 @@ float PitchDetector::detectPitch(const float *buffer, int bufferSize,
   if (bufferSize < maxPeriod * 2)
     return -1.0f;
 
-  std::vector<float> yinBuffer(maxPeriod + 1, 0.0f);
+  auto &scratch = getYinScratch(bufferSize, maxPeriod);
+  auto &yinBuffer = scratch.yinBuffer;
+
+  // Step 1: Difference function over a window of windowSize samples
+  //   d(tau) = sum (x[i] - x[i + tau])^2
+  //          = energy(0) + energy(tau) - 2 * r(tau)
+  // with r the cross-correlation of the window with the buffer, computed
+  // with one FFT of each. The FFT size covers the buffer, so the circular
+  // correlation does not wrap for tau <= maxPeriod.
+  const int windowSize = bufferSize - maxPeriod;
+  const int fftSize = 1 << scratch.fftOrder;
+
+  float *window = scratch.window.data();
+  float *signal = scratch.signal.data();
+
+  std::copy(buffer, buffer + windowSize, window);
+  std::fill(window + windowSize, window + 2 * fftSize, 0.0f);
+  std::copy(buffer, buffer + bufferSize, signal);
+  std::fill(signal + bufferSize, signal + 2 * fftSize, 0.0f);
+
+  scratch.fft->performRealOnlyForwardTransform(window, true);
+  scratch.fft->performRealOnlyForwardTransform(signal, true);
+
+  // conj(window) * signal, non-negative frequencies only
+  for (int k = 0; k <= fftSize / 2; k++) {
+    const float wr = window[2 * k], wi = window[2 * k + 1];
+    const float sr = signal[2 * k], si = signal[2 * k + 1];
+    window[2 * k] = wr * sr + wi * si;
+    window[2 * k + 1] = wr * si - wi * sr;
+  }
+
+  scratch.fft->performRealOnlyInverseTransform(window);
+
+  double *sumSquares = scratch.sumSquares.data();
+  sumSquares[0] = 0.0;
+  for (int i = 0; i < bufferSize; i++)
+    sumSquares[i + 1] = sumSquares[i] + (double)buffer[i] * buffer[i];
 
-  // Step 1: Difference function
+  const double windowEnergy = sumSquares[windowSize];
   for (int tau = 0; tau <= maxPeriod; tau++) {
-    yinBuffer[tau] = 0.0f;
-    for (int i = 0; i < bufferSize - maxPeriod; i++) {
-      float delta = buffer[i] - buffer[i + tau];
-      yinBuffer[tau] += delta * delta;
-    }
+    const double shiftedEnergy =
+        sumSquares[tau + windowSize] - sumSquares[tau];
+    const double difference =
+        windowEnergy + shiftedEnergy - 2.0 * (double)window[tau];
+    yinBuffer[tau] = (float)std::max(difference, 0.0);
   }
 
   // Step 2: Cumulative mean normalized difference
@@ -79,8 +164,11 @@ PitchDetector::analyze(const juce::AudioBuffer<float> &buffer,
                        double sampleRate) {
   // Prepare audio: convert to mono and resample to 22050 Hz (required by
   // BasicPitch)
-  auto preparedAudio = prepareAudio(buffer, sampleRate);
+  return transcribe(prepareAudio(buffer, sampleRate));
+}
 
+std::vector<Notes::Event>
+PitchDetector::transcribe(const std::vector<float> &preparedAudio) {
   if (preparedAudio.empty()) {
     return {};
   }
@@ -123,52 +211,155 @@ PitchDetector::analyzeSimple(const juce::AudioBuffer<float> &buffer,
   return notes;
 }
 
+std::vector<MidiNote>
+PitchDetector::toMidiNotes(const std::vector<Notes::Event> &events,
+                           double sampleRate) {
+  std::vector<MidiNote> midiNotes;
+  midiNotes.reserve(events.size());
+
+  for (const auto &note : events) {
+    MidiNote midi;
+    midi.noteNumber = note.pitch; // Notes::Event uses 'pitch'
+    midi.startSample = (int)(note.startTime * sampleRate);
+    midi.endSample = (int)(note.endTime * sampleRate);
+    midi.velocity = (float)note.amplitude; // Notes::Event uses 'amplitude'
+    midi.centOffset = 0.0f; // NeuralNote handles pitch internally
+    midiNotes.push_back(midi);
+  }
+
+  return midiNotes;
+}
+
 std::vector<float>
 PitchDetector::prepareAudio(const juce::AudioBuffer<float> &buffer,
                             double sourceSampleRate) {
-  std::vector<float> result;
-
-  // Mix to mono
-  int numSamples = buffer.getNumSamples();
-  std::vector<float> monoBuffer(numSamples);
-
-  if (buffer.getNumChannels() > 1) {
-    // Average all channels
-    for (int i = 0; i < numSamples; i++) {
-      float sum = 0.0f;
-      for (int ch = 0; ch < buffer.getNumChannels(); ch++) {
-        sum += buffer.getReadPointer(ch)[i];
-      }
-      monoBuffer[i] = sum / buffer.getNumChannels();
-    }
-  } else {
-    // Single channel - just copy
-    std::copy(buffer.getReadPointer(0), buffer.getReadPointer(0) + numSamples,
-              monoBuffer.begin());
-  }
+  const int numSamples = buffer.getNumSamples();
+  const int numChannels = buffer.getNumChannels();
+
+  if (numSamples == 0 || numChannels == 0)
+    return {};
+
+  TRACE_SCOPE(scope, "resample");
+  TRACE_FRAMES(scope, numSamples);
 
   // Resample to 22050 Hz if needed (BasicPitch requires 22050 Hz)
   const int targetSampleRate = 22050;
 
   if (std::abs(sourceSampleRate - targetSampleRate) < 1.0) {
-    // No resampling needed
-    return monoBuffer;
+    // No resampling needed: mix to mono only
+    std::vector<float> result(buffer.getReadPointer(0),
+                              buffer.getReadPointer(0) + numSamples);
+
+    if (numChannels > 1) {
+      for (int ch = 1; ch < numChannels; ch++)
+        juce::FloatVectorOperations::add(result.data(),
+                                         buffer.getReadPointer(ch), numSamples);
+      juce::FloatVectorOperations::multiply(result.data(), 1.0f / numChannels,
+                                            numSamples);
+    }
+
+    TRACE_BYTES(scope, result.size() * sizeof(float));
+    return result;
   }
 
-  // Simple linear interpolation resampling
-  double ratio = sourceSampleRate / (double)targetSampleRate;
-  int targetLength = (int)(numSamples / ratio);
-  result.resize(targetLength);
+  // Polyphase FIR resampling, mixing to mono in the same pass
+  resampler.prepare(sourceSampleRate, targetSampleRate);
 
-  for (int i = 0; i < targetLength; i++) {
-    double sourcePos = i * ratio;
-    int idx1 = (int)sourcePos;
-    int idx2 = std::min(idx1 + 1, numSamples - 1);
-    double frac = sourcePos - idx1;
+  std::vector<float> result((size_t)resampler.getMaxOutputSamples(numSamples) +
+                            (size_t)resampler.getMaxOutputSamples(0));
 
-    result[i] =
-        (float)(monoBuffer[idx1] * (1.0 - frac) + monoBuffer[idx2] * frac);
-  }
+  int numWritten = resampler.process(buffer.getArrayOfReadPointers(),
+                                     numChannels, numSamples, result.data());
+  numWritten += resampler.finish(result.data() + numWritten);
 
+  result.resize((size_t)numWritten);
+  TRACE_BYTES(scope, result.capacity() * sizeof(float));
   return result;
 }
+
+std::vector<Notes::Event> PitchDetector::analyze(const SampleStore &store) {
+  const int64_t numSamples = store.getNumSamples();
+
+  if (numSamples == 0 || store.getNumChannels() == 0)
+    return {};
+
+  // Converted by a previous transcription of the sample
+  if (const auto signal = store.getAnalysisSignal())
+    return transcribe(*signal);
+
+  // Same conversion as for a buffer, block by block, each block being given to
+  // BasicPitch as soon as it is converted. For a sample still being decoded,
+  // shards are transcribed while the rest of the file is decoded.
+  const int targetSampleRate = 22050;
+  const bool needsResampling =
+      std::abs(store.getSampleRate() - targetSampleRate) >= 1.0;
+
+  std::vector<float> converted;
+  int64_t expectedNumSamples = numSamples;
+
+  if (needsResampling) {
+    resampler.prepare(store.getSampleRate(), targetSampleRate);
+    expectedNumSamples = resampler.getNumOutputSamples(numSamples);
+    converted.resize((size_t)std::max(
+        resampler.getMaxOutputSamples(SampleStore::kDefaultBlockSize),
+        resampler.getMaxOutputSamples(0)));
+  } else {
+    converted.resize((size_t)SampleStore::kDefaultBlockSize);
+  }
+
+  basicPitch.reset();
+  basicPitch.beginTranscription((size_t)expectedNumSamples);
+
+  auto convertBlock = [&](const float *const *channels, int numChannels,
+                          int blockSize) {
+    int numWritten = blockSize;
+
+    // Closed before pushAudio, which can wait for the shard workers
+    {
+      TRACE_SCOPE(scope, "resample");
+      TRACE_FRAMES(scope, blockSize);
+
+      if (!needsResampling) {
+        // Mix to mono only
+        float *mono = converted.data();
+
+        juce::FloatVectorOperations::copy(mono, channels[0], blockSize);
+        if (numChannels > 1) {
+          for (int ch = 1; ch < numChannels; ch++)
+            juce::FloatVectorOperations::add(mono, channels[ch], blockSize);
+          juce::FloatVectorOperations::multiply(mono, 1.0f / numChannels,
+                                                blockSize);
+        }
+      } else {
+        numWritten = resampler.process(channels, numChannels, blockSize,
+                                       converted.data());
+      }
+    }
+
+    basicPitch.pushAudio(converted.data(), (size_t)numWritten);
+  };
+
+  store.forEachBlock(convertBlock, SampleStore::kDefaultBlockSize,
+                     [this] { return basicPitch.isCancelled(); });
+
+  if (needsResampling) {
+    const int numWritten = resampler.finish(converted.data());
+    basicPitch.pushAudio(converted.data(), (size_t)numWritten);
+  }
+
+  basicPitch.endTranscription();
+
+  // Keep the converted signal with the sample for the next transcriptions,
+  // unless it was cut short
+  if (!basicPitch.isCancelled()) {
+    auto signal =
+        std::make_shared<const std::vector<float>>(basicPitch.takeAudio());
+    TRACE_COUNT("resample", signal->capacity() * sizeof(float), 0);
+    store.setAnalysisSignal(std::move(signal));
+  }
+
+  // Update MIDI with current parameters
+  basicPitch.updateMIDI();
+
+  return basicPitch.getNoteEvents();
+}
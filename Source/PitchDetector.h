@@ -1,7 +1,12 @@
 #pragma once
 
 #include "BasicPitch.h"
+#include "MidiBuilder.h"
 #include "Notes.h"
+#include "PolyphaseResampler.h"
+#include "SampleStore.h"
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <vector>
@@ -10,19 +15,47 @@
 class PitchDetector {
 public:
   PitchDetector() {
-    // Initialize BasicPitch with default parameters
-    // Note sensitivity: 0.7 (higher = more notes)
-    // Split sensitivity: 0.5 (higher = more note splitting)
-    // Min note duration: 60ms
-    basicPitch.setParameters(0.7f, 0.5f, 60.0f);
+    setParameters(kDefaultNoteSensitivity, kDefaultSplitSensitivity);
+    basicPitch.setFeaturesSessionParams(getFeaturesSessionParams());
   }
 
   void prepare(double sampleRate) { this->sampleRate = sampleRate; }
 
+  // Same meaning as BasicPitch::setParameters, with notes of at least
+  // kMinNoteDurationMs. Not to be called while a transcription is running.
+  void setParameters(float noteSensitivity, float splitSensitivity) {
+    basicPitch.setParameters(noteSensitivity, splitSensitivity,
+                             kMinNoteDurationMs);
+  }
+
+  // Default parameters
+  // Note sensitivity: higher = more notes
+  static constexpr float kDefaultNoteSensitivity = 0.7f;
+  // Split sensitivity: higher = more note splitting
+  static constexpr float kDefaultSplitSensitivity = 0.5f;
+  static constexpr float kMinNoteDurationMs = 60.0f;
+
+  // Number of threads used by BasicPitch to transcribe (sharded over time)
+  void setNumThreads(int numThreads) {
+    basicPitch.setNumThreads((size_t)std::max(numThreads, 1));
+  }
+
+  // Features of the whole signal in a single model call, the reference the
+  // drift of the chunked features is measured against (see
+  // BasicPitch::setSingleFeaturesCall)
+  void setSingleFeaturesCall(bool singleCall) {
+    basicPitch.setSingleFeaturesCall(singleCall);
+  }
+
   // Returns vector of Notes::Event from BasicPitch (2-arg version)
   std::vector<Notes::Event> analyze(const juce::AudioBuffer<float> &buffer,
                                     double sampleRate);
 
+  // Transcribe a whole sample, read block by block. Blocks are transcribed as
+  // they are read, so a sample still being decoded is transcribed while it is
+  // decoded.
+  std::vector<Notes::Event> analyze(const SampleStore &store);
+
   // Compatibility: single-arg version uses stored sampleRate
   std::vector<Notes::Event> analyze(const juce::AudioBuffer<float> &buffer) {
     return analyze(buffer, sampleRate);
@@ -42,11 +75,46 @@ public:
   std::vector<Note> analyzeSimple(const juce::AudioBuffer<float> &buffer,
                                   double sampleRate);
 
+  // Convert Notes::Event (times in seconds) to MidiNote (times in samples at
+  // sampleRate)
+  static std::vector<MidiNote>
+  toMidiNotes(const std::vector<Notes::Event> &events, double sampleRate);
+
+  // Cancel the running transcription, from any thread. Transcriptions return
+  // no notes until clearCancel is called.
+  void cancel() { basicPitch.cancel(); }
+  void clearCancel() { basicPitch.clearCancel(); }
+
+  // Fraction of the running transcription done, can be polled from any thread
+  float getProgress() const { return basicPitch.getProgress(); }
+
+  // Pitch class profile of the last transcription (C first), folded from the
+  // CQT features of the neural model
+  const std::array<float, 12> &getChroma() const {
+    return basicPitch.getChroma();
+  }
+
+  // Model of the last transcription, e.g. to compare its posteriorgrams
+  const BasicPitch &getBasicPitch() const { return basicPitch; }
+
+  // Features model optimized once and cached in the user application data
+  // directory. Instances using the same parameters share the model.
+  static Features::SessionParams getFeaturesSessionParams();
+
 private:
+  // Benchmark of prepareAudio (Tools/TranscriptionBenchmarks.cpp)
+  friend struct BenchmarkAccess;
+
   double sampleRate = 44100.0;
   BasicPitch basicPitch;
+  PolyphaseResampler resampler;
 
-  // Convert audio buffer to mono and resample to 22050 Hz
+  // Convert audio buffer to mono and resample to 22050 Hz (windowed-sinc
+  // polyphase filter, single pass)
   std::vector<float> prepareAudio(const juce::AudioBuffer<float> &buffer,
                                   double sourceSampleRate);
+
+  // Run BasicPitch on mono 22050 Hz audio
+  std::vector<Notes::Event>
+  transcribe(const std::vector<float> &preparedAudio);
 };
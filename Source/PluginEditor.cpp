@@ -50,6 +50,7 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
                       juce::dontSendNotification);
   addAndMakeVisible(statusDot);
   addAndMakeVisible(statusLabel);
+  progressPoller.onTick = [this] { updateProgress(); };
 
   loadButton.setColour(juce::TextButton::buttonColourId,
                        juce::Colours::transparentBlack);
@@ -63,7 +64,6 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
       statusLabel.setText(juce::String("Analyzing..."),
                           juce::dontSendNotification);
       statusLabel.setColour(juce::Label::textColourId, Colors::textGray);
-      waveformDisplay.setFile(file);
       hasSample = true;
       dragZone.setVisible(true);
       resized();
@@ -71,12 +71,10 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
       audioProcessor.loadAndAnalyze(
           file, [this](int noteCount) { updateStatus(noteCount); },
           [this]() {
-            // Update spectral display when load completes
-            auto buffer = audioProcessor.getAudioBuffer();
-            if (buffer && buffer->getNumSamples() > 0) {
-              spectralDisplay.setAudioData(
-                  buffer->getReadPointer(0), buffer->getNumSamples(),
-                  audioProcessor.getCurrentSampleRate());
+            // Update waveform and spectral displays when load completes
+            if (auto store = audioProcessor.getSampleStore()) {
+              waveformDisplay.setSampleStore(*store);
+              spectralDisplay.setAudioData(*store);
             }
 
             // Update note editor with detected notes
@@ -86,6 +84,7 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
               filteredNotes = notes;
             }
           });
+      progressPoller.startTimer(100);
     });
   };
 
@@ -227,6 +226,22 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
   addAndMakeVisible(noteEditorToggle);
   noteEditor.setVisible(false);
 
+  // ---- Live mode toggle ----
+  // Transcribes the plugin input to the MIDI output while enabled
+  liveModeToggle.setColour(juce::TextButton::buttonColourId, Colors::inputBg);
+  liveModeToggle.setColour(juce::TextButton::textColourOffId, Colors::textGray);
+  liveModeToggle.setColour(juce::TextButton::buttonOnColourId,
+                           Colors::accentCyan);
+  liveModeToggle.setColour(juce::TextButton::textColourOnId,
+                           juce::Colours::black);
+  liveModeToggle.setClickingTogglesState(true);
+  liveModeToggle.setToggleState(audioProcessor.isLiveModeEnabled(),
+                                juce::dontSendNotification);
+  liveModeToggle.onClick = [this] {
+    audioProcessor.setLiveModeEnabled(liveModeToggle.getToggleState());
+  };
+  addAndMakeVisible(liveModeToggle);
+
   // Note editor callback
   noteEditor.onNotesChanged = [this](std::vector<MidiNote> activeNotes) {
     filteredNotes = activeNotes;
@@ -310,7 +325,8 @@ Sample2MidiAudioProcessorEditor::Sample2MidiAudioProcessorEditor(
       MidiBuilder mb;
       mb.exportMidi(audioProcessor.getDetectedNotes(),
                     audioProcessor.getCurrentSampleRate(), tempFile,
-                    audioProcessor.detectedBPM.load());
+                    audioProcessor.detectedBPM.load(),
+                    audioProcessor.detectedBeatOffset.load());
 
       if (tempFile.existsAsFile()) {
         juce::DragAndDropContainer::performExternalDragDropOfFiles(
@@ -573,6 +589,10 @@ void Sample2MidiAudioProcessorEditor::resized() {
   noteEditorToggle.setBounds(
       row2.removeFromLeft(noteToggleWidth).reduced(0, 4));
 
+  // Live mode toggle button
+  row2.removeFromLeft(juce::jmax(8, (int)(editorWidth * 0.01f)));
+  liveModeToggle.setBounds(row2.removeFromLeft(noteToggleWidth).reduced(0, 4));
+
   // Export button: right aligned (15% width)
   auto exportWidth = (int)(editorWidth * 0.15f);
   exportWidth = juce::jmax(100, exportWidth);
@@ -708,11 +728,13 @@ void Sample2MidiAudioProcessorEditor::drawGripIcon(
 // updateStatus
 // ---------------------------------------------------------------------------
 void Sample2MidiAudioProcessorEditor::updateStatus(int noteCount) {
+  progressPoller.stopTimer();
+
   if (noteCount > 0) {
     statusLabel.setColour(juce::Label::textColourId, Colors::successGreen);
     statusLabel.setText(
         juce::String(noteCount) + " notes | " +
-            juce::String((int)audioProcessor.detectedBPM.load()) +
+            juce::String(juce::roundToInt(audioProcessor.detectedBPM.load())) +
             juce::String(" BPM — drag to export"),
         juce::dontSendNotification);
   } else {
@@ -736,7 +758,6 @@ void Sample2MidiAudioProcessorEditor::filesDropped(
   juce::File file(files[0]);
   statusLabel.setColour(juce::Label::textColourId, Colors::textGray);
   statusLabel.setText(juce::String("Analyzing..."), juce::dontSendNotification);
-  waveformDisplay.setFile(file);
   hasSample = true;
   dragZone.setVisible(true);
   resized();
@@ -744,14 +765,26 @@ void Sample2MidiAudioProcessorEditor::filesDropped(
   audioProcessor.loadAndAnalyze(
       file, [this](int noteCount) { updateStatus(noteCount); },
       [this]() {
-        // Update spectral display when load completes
-        auto buffer = audioProcessor.getAudioBuffer();
-        if (buffer && buffer->getNumSamples() > 0) {
-          spectralDisplay.setAudioData(buffer->getReadPointer(0),
-                                       buffer->getNumSamples(),
-                                       audioProcessor.getCurrentSampleRate());
+        // Update waveform and spectral displays when load completes
+        if (auto store = audioProcessor.getSampleStore()) {
+          waveformDisplay.setSampleStore(*store);
+          spectralDisplay.setAudioData(*store);
         }
       });
+  progressPoller.startTimer(100);
+}
+
+// ---------------------------------------------------------------------------
+// updateProgress
+// ---------------------------------------------------------------------------
+void Sample2MidiAudioProcessorEditor::updateProgress() {
+  if (!audioProcessor.isAnalysisRunning())
+    return;
+
+  const int percent =
+      juce::roundToInt(100.0f * audioProcessor.getAnalysisProgress());
+  statusLabel.setText("Analyzing... " + juce::String(percent) + "%",
+                      juce::dontSendNotification);
 }
 
 // ---------------------------------------------------------------------------
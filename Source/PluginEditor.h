@@ -149,6 +149,9 @@ public:
 
   void updateStatus(int noteCount);
 
+  // Show the progress of the running analysis in the status label
+  void updateProgress();
+
 private:
   // -------------------------------------------------------------------------
   // Icon helpers
@@ -217,6 +220,16 @@ private:
   } statusDot;
 
   juce::Label statusLabel;
+
+  // Polls the analysis progress while a sample is being analyzed
+  struct ProgressPoller : public juce::Timer {
+    std::function<void()> onTick;
+
+    void timerCallback() override {
+      if (onTick)
+        onTick();
+    }
+  } progressPoller;
   juce::TextButton loadButton{"Load Sample"};
 
   // Row 1 controls
@@ -241,6 +254,7 @@ private:
   } stopButton;
 
   juce::TextButton noteEditorToggle{"Notes \u270F"};
+  juce::TextButton liveModeToggle{"Live MIDI"};
   juce::TextButton exportButton{"Export MIDI"};
 
   // Zoom
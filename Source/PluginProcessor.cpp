@@ -1,19 +1,34 @@
 #include "PluginProcessor.h"
+#include "KeyDetector.h"
 #include "PluginEditor.h"
+#include "TempoDetector.h"
 #include <algorithm>
 #include <cmath>
-#include <map>
+#include <future>
 
 Sample2MidiAudioProcessor::Sample2MidiAudioProcessor()
-    : AudioProcessor(BusesProperties().withOutput(
-          "Output", juce::AudioChannelSet::stereo(), true)) {
+    : AudioProcessor(
+          BusesProperties()
+              .withInput("Input", juce::AudioChannelSet::stereo(), true)
+              .withOutput("Output", juce::AudioChannelSet::stereo(), true)) {
   formatManager.registerBasicFormats();
+
+  // Leave one core for the audio and message threads
+  setNumAnalysisThreads(juce::SystemStats::getNumCpus() - 1);
+
+  // Live mode uses the same parameters as the analysis
+  setTranscriptionParameters(noteSensitivity, splitSensitivity);
 }
 
 Sample2MidiAudioProcessor::~Sample2MidiAudioProcessor() {
-  // Stop analysis thread safely
-  shouldStopAnalysis = true;
+  // Stop decoding first: an analysis reading a sample being decoded only ends
+  // once the decoding does
+  audioFileLoader.stopThread(4000);
+
+  // Stop analysis thread safely, at its next cancellation checkpoint
   if (analysisThread != nullptr) {
+    analysisThread->signalThreadShouldExit();
+    pitchDetector.cancel();
     analysisThread->stopThread(3000);
   }
 
@@ -24,15 +39,26 @@ void Sample2MidiAudioProcessor::prepareToPlay(double sampleRate,
                                               int samplesPerBlock) {
   currentSampleRate = sampleRate;
   transportSource.prepareToPlay(samplesPerBlock, sampleRate);
+
+  liveTranscriber.prepare(sampleRate, samplesPerBlock);
+  setLatencySamples(liveTranscriber.isEnabled()
+                        ? liveTranscriber.getLatencySamples()
+                        : 0);
 }
 
 void Sample2MidiAudioProcessor::releaseResources() {
   transportSource.releaseResources();
+  liveTranscriber.release();
 }
 
 void Sample2MidiAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                              juce::MidiBuffer &midiMessages) {
   juce::ScopedNoDenormals noDenormals;
+
+  // Live mode: the input is transcribed before the buffer is reused for
+  // the output
+  liveTranscriber.process(buffer, getTotalNumInputChannels(), midiMessages);
+
   buffer.clear();
 
   // Fill output with audio from the transport source (preview playback)
@@ -42,6 +68,22 @@ void Sample2MidiAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
   }
 }
 
+void Sample2MidiAudioProcessor::setLiveModeEnabled(bool shouldBeEnabled) {
+  liveTranscriber.setEnabled(shouldBeEnabled);
+  setLatencySamples(shouldBeEnabled ? liveTranscriber.getLatencySamples() : 0);
+}
+
+bool Sample2MidiAudioProcessor::isLiveModeEnabled() const {
+  return liveTranscriber.isEnabled();
+}
+
+void Sample2MidiAudioProcessor::setTranscriptionParameters(
+    float newNoteSensitivity, float newSplitSensitivity) {
+  noteSensitivity = newNoteSensitivity;
+  splitSensitivity = newSplitSensitivity;
+  liveTranscriber.setParameters(newNoteSensitivity, newSplitSensitivity);
+}
+
 bool Sample2MidiAudioProcessor::hasEditor() const { return true; }
 juce::AudioProcessorEditor *Sample2MidiAudioProcessor::createEditor() {
   return new Sample2MidiAudioProcessorEditor(*this);
@@ -63,95 +105,197 @@ void Sample2MidiAudioProcessor::loadAndAnalyze(
   // Clear previous notes when loading new sample
   detectedNotes.clear();
 
+  // Trace of this file only
+  Trace::Recorder::get().clear();
+
   audioFileLoader.loadAsync(
       file, formatManager,
-      [this, file, onComplete, onLoadComplete](juce::AudioBuffer<float> buffer,
-                                               double sampleRate) {
+      [this, onComplete,
+       onLoadComplete](std::shared_ptr<const SampleStore> store) {
         // This lambda runs on the message thread.
-        if (buffer.getNumSamples() == 0) {
+        if (store == nullptr) {
           if (onComplete)
             onComplete(0);
           return;
         }
 
-        currentSampleRate = sampleRate;
-
-        // Set up transport source for preview playback
-        // Re-open the file for the reader source (transport needs its own
-        // reader)
-        auto *reader = formatManager.createReaderFor(file);
-        if (reader != nullptr) {
-          transportSource.stop();
-          transportSource.setSource(nullptr);
-          readerSource =
-              std::make_unique<juce::AudioFormatReaderSource>(reader, true);
-          transportSource.setSource(readerSource.get(), 0, nullptr, sampleRate);
+        currentSampleRate = store->getSampleRate();
+
+        // Set up transport source for preview playback, reading the store
+        transportSource.stop();
+        transportSource.setSource(nullptr);
+        readerSource = std::make_unique<juce::AudioFormatReaderSource>(
+            store->createReader().release(), true);
+        transportSource.setSource(readerSource.get(), 0, nullptr,
+                                  store->getSampleRate());
+
+        // Store the sample but don't analyze - user must click "Process"
+        // (compressed files are analyzed as they are decoded)
+        sampleStore = store;
+
+        // Store sample for later processing, unless it is already being
+        // analyzed since it was opened
+        {
+          juce::ScopedLock lock(analysisMutex);
+          if (analysisStore != store) {
+            analysisStore = store;
+            hasAnalysisChroma = false;
+          }
         }
 
         if (onLoadComplete)
           onLoadComplete();
+      },
+      [this, onComplete](std::shared_ptr<const SampleStore> store) {
+        // Compressed files are still being decoded: analyze them while they
+        // are decoded instead of once loaded, the analysis reading the samples
+        // as they come
+        if (store->isComplete())
+          return;
 
-        // Store the buffer but don't analyze - user must click "Process"
-        auto sharedBuffer =
-            std::make_shared<juce::AudioBuffer<float>>(std::move(buffer));
-
-        storedAudioBuffer =
-            std::make_shared<juce::AudioBuffer<float>>(*sharedBuffer);
-
-        // Store buffer for later processing
         {
           juce::ScopedLock lock(analysisMutex);
-          analysisBuffer = sharedBuffer;
-          analysisSampleRate = sampleRate;
+          analysisStore = store;
+          hasAnalysisChroma = false;
         }
+
+        analysisCallback = onComplete;
+        processSample();
       });
 }
 
 void Sample2MidiAudioProcessor::processSample() {
-  // Run analysis on background thread
-  if (analysisThread != nullptr) {
-    shouldStopAnalysis = true;
-    analysisThread->stopThread(3000);
-    analysisThread = nullptr;
+  // Run analysis on background thread. A running analysis is cancelled but
+  // not waited for here: the new thread waits for it to reach a cancellation
+  // checkpoint.
+  auto previousThread = std::move(analysisThread);
+  if (previousThread != nullptr) {
+    previousThread->signalThreadShouldExit();
+    pitchDetector.cancel();
   }
-  shouldStopAnalysis = false;
 
-  analysisThread = std::make_unique<AnalysisThread>(*this);
+  analysisThread =
+      std::make_unique<AnalysisThread>(*this, std::move(previousThread));
   analysisThread->startThread(juce::Thread::Priority::low);
 }
 
+float Sample2MidiAudioProcessor::getAnalysisProgress() const {
+  return pitchDetector.getProgress();
+}
+
+bool Sample2MidiAudioProcessor::isAnalysisRunning() const {
+  return analysisThread != nullptr && analysisThread->isThreadRunning();
+}
+
 std::vector<MidiNote>
-Sample2MidiAudioProcessor::analyzeBuffer(const juce::AudioBuffer<float> &buffer,
-                                         double sampleRate) {
+Sample2MidiAudioProcessor::analyzeSample(const SampleStore &store) {
+  const double sampleRate = store.getSampleRate();
+
   // Prepare the neural pitch detector
   pitchDetector.prepare(sampleRate);
 
-  DBG("=== analyzeBuffer called ===");
-  DBG("Buffer samples: " + juce::String(buffer.getNumSamples()));
+  DBG("=== analyzeSample called ===");
+  DBG("Sample length: " + juce::String(store.getNumSamples()));
   DBG("Sample rate: " + juce::String(sampleRate));
 
   // Use NeuralNote to analyze the audio
-  auto notes = pitchDetector.analyze(buffer);
+  auto notes = pitchDetector.analyze(store);
 
   DBG("Notes from pitchDetector.analyze: " + juce::String(notes.size()));
 
   // Convert Notes::Event to MidiNote
-  std::vector<MidiNote> midiNotes;
-  for (const auto &note : notes) {
-    MidiNote midi;
-    midi.noteNumber = note.pitch; // Notes::Event uses 'pitch'
-    midi.startSample = (int)(note.startTime * sampleRate);
-    midi.endSample = (int)(note.endTime * sampleRate);
-    midi.velocity = (float)note.amplitude; // Notes::Event uses 'amplitude'
-    midi.centOffset = 0.0f; // NeuralNote handles pitch internally
-    midiNotes.push_back(midi);
-  }
+  auto midiNotes = PitchDetector::toMidiNotes(notes, sampleRate);
 
   DBG("MidiNotes created: " + juce::String(midiNotes.size()));
 
   return midiNotes;
 }
 
+// ---------------------------------------------------------------------------
+// Key / tempo detection
+// ---------------------------------------------------------------------------
+
+juce::String Sample2MidiAudioProcessor::detectScaleFromAudio() {
+  TRACE_SCOPE(scope, "key");
+
+  std::shared_ptr<const SampleStore> store;
+  std::array<float, 12> chroma;
+  bool hasChroma;
+  {
+    juce::ScopedLock lock(analysisMutex);
+    store = analysisStore;
+    chroma = analysisChroma;
+    hasChroma = hasAnalysisChroma;
+  }
+
+  // Once the sample is transcribed, its chromagram comes for free with the
+  // CQT features of the neural model
+  if (hasChroma) {
+    if (auto key = KeyDetector::detect(chroma))
+      return key->getName();
+    return {};
+  }
+
+  if (!store || store->getNumSamples() == 0)
+    return {};
+
+  // Not transcribed yet: pitch class profile of the sample from time domain
+  // pitch estimates, weighted by frame energy
+  const int windowSize = 4096;
+  const int hopSize = 2048;
+  const double sampleRate = store->getSampleRate();
+  const int64_t numSamples = store->getNumSamples();
+  TRACE_FRAMES(scope, numSamples);
+
+  std::vector<float> window((size_t)windowSize);
+  float *data = window.data();
+
+  std::array<float, 12> pitchProfile{};
+  bool hasPitch = false;
+
+  for (int64_t start = 0; start + windowSize <= numSamples;
+       start += hopSize) {
+    store->read(&data, 1, start, windowSize);
+
+    double energy = 0;
+    for (int i = 0; i < windowSize; ++i)
+      energy += data[i] * data[i];
+    energy = std::sqrt(energy / windowSize);
+
+    if (energy < 0.01)
+      continue; // Silence
+
+    float midiNote =
+        pitchDetector.detectPitch(data, windowSize, sampleRate);
+    if (midiNote < 0)
+      continue;
+
+    int pitchClass = ((int)std::round(midiNote) % 12 + 12) % 12;
+    pitchProfile[(size_t)pitchClass] += (float)energy;
+    hasPitch = true;
+  }
+
+  if (!hasPitch)
+    return {};
+
+  if (auto key = KeyDetector::detect(pitchProfile))
+    return key->getName();
+
+  return {};
+}
+
+void Sample2MidiAudioProcessor::setFilteredNotes(std::vector<MidiNote> notes) {
+  filteredNotes = std::move(notes);
+}
+
+void Sample2MidiAudioProcessor::setNumAnalysisThreads(int numThreads) {
+  numAnalysisThreads = juce::jmax(1, numThreads);
+}
+
+int Sample2MidiAudioProcessor::getNumAnalysisThreads() const {
+  return numAnalysisThreads.load();
+}
+
 // ---------------------------------------------------------------------------
 // Playback
 // ----------------------------------------------------------------------------
@@ -182,7 +326,10 @@ double Sample2MidiAudioProcessor::getTransportSourcePosition() const {
 // -----------------------------------------------------------------------
 
 void Sample2MidiAudioProcessor::exportMidiToFile() {
-  if (detectedNotes.empty())
+  // Export the notes edited in the note editor, if any
+  const auto &notesToExport =
+      filteredNotes.empty() ? detectedNotes : filteredNotes;
+  if (notesToExport.empty())
     return;
 
   auto chooser = std::make_shared<juce::FileChooser>(
@@ -194,161 +341,29 @@ void Sample2MidiAudioProcessor::exportMidiToFile() {
   chooser->launchAsync(juce::FileBrowserComponent::saveMode |
                            juce::FileBrowserComponent::canSelectFiles |
                            juce::FileBrowserComponent::warnAboutOverwriting,
-                       [this, chooser](const juce::FileChooser &fc) {
+                       [this, chooser, notesToExport](
+                           const juce::FileChooser &fc) {
                          auto result = fc.getResult();
                          if (result != juce::File{}) {
-                           midiBuilder.exportMidi(detectedNotes,
+                           midiBuilder.exportMidi(notesToExport,
                                                   currentSampleRate, result,
-                                                  120.0f);
+                                                  detectedBPM.load(),
+                                                  detectedBeatOffset.load());
                          }
                        });
 }
 
-juce::AudioProcessor *JUCE_CALLTYPE createPluginFilter() {
-  return new Sample2MidiAudioProcessor();
-}
-
 // -----------------------------------------------------------------------
-// Internal analysis thread method
+// Tracing
 // -----------------------------------------------------------------------
 
-void Sample2MidiAudioProcessor::runAnalysisInternal() {
-  if (shouldStopAnalysis || analysisThread->threadShouldExit())
-    return;
-  double covMajor = 0, covMinor = 0;
-  double varProfile = 0, varMajor = 0, varMinor = 0;
-
-  for (int j = 0; j < 12; ++j) {
-    double dp = pitchProfile[j] - meanProfile;
-    double dm = rotatedMajor[j] - meanMajor;
-    double dn = rotatedMinor[j] - meanMinor;
-
-    covMajor += dp * dm;
-    covMinor += dp * dn;
-    varProfile += dp * dp;
-    varMajor += dm * dm;
-    varMinor += dn * dn;
-  }
-
-  // Pearson correlation
-  double corrMajor = 0, corrMinor = 0;
-  if (varProfile > 0 && varMajor > 0)
-    corrMajor = covMajor / std::sqrt(varProfile * varMajor);
-  if (varProfile > 0 && varMinor > 0)
-    corrMinor = covMinor / std::sqrt(varProfile * varMinor);
-
-  if (corrMajor > bestCorrelationMajor) {
-    bestCorrelationMajor = corrMajor;
-    bestRootMajor = r;
-  }
-  if (corrMinor > bestCorrelationMinor) {
-    bestCorrelationMinor = corrMinor;
-    bestRootMinor = r;
-  }
-}
-
-// Map to scale names
-const char *majorRoots[] = {"C",  "C#", "D",  "D#", "E",  "F",
-                            "F#", "G",  "G#", "A",  "A#", "B"};
-const char *minorRoots[] = {"C",  "C#", "D",  "D#", "E",  "F",
-                            "F#", "G",  "G#", "A",  "A#", "B"};
-
-if (bestCorrelationMajor >= bestCorrelationMinor) {
-  return juce::String(majorRoots[bestRootMajor]) + " Major";
-} else {
-  return juce::String(minorRoots[bestRootMinor]) + " Minor";
-}
-}
-
-// -----------------------------------------------------------------------
-// Internal analysis thread method
-// -----------------------------------------------------------------------
-return 120.0; // Default BPM
-
-const float *data = buffer.getReadPointer(0);
-int numSamples = buffer.getNumSamples();
-double rate = sampleRate;
-
-// Simple onset detection using energy difference
-const int blockSize = 1024;
-std::vector<double> onsetStrength;
-
-for (int i = blockSize; i < numSamples - blockSize; i += blockSize) {
-  double energy = 0;
-  for (int j = 0; j < blockSize; ++j) {
-    energy += data[i + j] * data[i + j];
-  }
-  energy = std::sqrt(energy / blockSize);
-
-  // Compare with previous block
-  double prevEnergy = 0;
-  for (int j = 0; j < blockSize; ++j) {
-    prevEnergy += data[i - blockSize + j] * data[i - blockSize + j];
-  }
-  prevEnergy = std::sqrt(prevEnergy / blockSize);
-
-  // Onset if energy increased significantly
-  if (energy > prevEnergy * 1.5) {
-    onsetStrength.push_back((double)i / rate);
-  }
-}
-
-if (onsetStrength.size() < 4)
-  return 120.0; // Not enough onsets detected
-
-// Find the most common interval between onsets
-std::map<double, int> intervalHistogram;
-
-for (size_t i = 1; i < onsetStrength.size(); ++i) {
-  double interval = onsetStrength[i] - onsetStrength[i - 1];
-  // Round to nearest common BPM interval
-  double bpm = 60.0 / interval;
-
-  // Quantize to common BPM values
-  bpm = std::round(bpm / 5.0) * 5.0;
-  bpm = std::clamp(bpm, 60.0, 200.0);
-
-  intervalHistogram[bpm]++;
-}
-
-// Find most common BPM
-double detectedBPM = 120.0;
-int maxCount = 0;
-for (const auto &pair : intervalHistogram) {
-  if (pair.second > maxCount) {
-    maxCount = pair.second;
-    detectedBPM = pair.first;
-  }
-}
-
-return detectedBPM;
+std::vector<Trace::StageTotals>
+Sample2MidiAudioProcessor::getTraceTotals() const {
+  return Trace::Recorder::get().getStageTotals();
 }
 
-// ---------------------------------------------------------------------------
-// MIDI export
-// ---------------------------------------------------------------------------
-
-void Sample2MidiAudioProcessor::exportMidiToFile() {
-  if (detectedNotes.empty())
-    return;
-
-  auto chooser = std::make_shared<juce::FileChooser>(
-      "Save MIDI file...",
-      juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
-          .getChildFile("Sample2MIDI_Export.mid"),
-      "*.mid");
-
-  chooser->launchAsync(juce::FileBrowserComponent::saveMode |
-                           juce::FileBrowserComponent::canSelectFiles |
-                           juce::FileBrowserComponent::warnAboutOverwriting,
-                       [this, chooser](const juce::FileChooser &fc) {
-                         auto result = fc.getResult();
-                         if (result != juce::File{}) {
-                           midiBuilder.exportMidi(detectedNotes,
-                                                  currentSampleRate, result,
-                                                  120.0f);
-                         }
-                       });
+bool Sample2MidiAudioProcessor::writeTrace(const juce::File &file) const {
+  return file.replaceWithText(Trace::Recorder::get().toChromeTraceJson());
 }
 
 juce::AudioProcessor *JUCE_CALLTYPE createPluginFilter() {
@@ -359,51 +374,100 @@ juce::AudioProcessor *JUCE_CALLTYPE createPluginFilter() {
 // Internal analysis thread method
 // -----------------------------------------------------------------------
 void Sample2MidiAudioProcessor::runAnalysisInternal() {
-  if (shouldStopAnalysis || analysisThread->threadShouldExit())
+  // Cleared before checking for exit: threads are signalled before the pitch
+  // detector is cancelled, so a cancellation is never lost
+  pitchDetector.clearCancel();
+
+  auto *thread = juce::Thread::getCurrentThread();
+  auto shouldStop = [thread] { return thread->threadShouldExit(); };
+
+  if (shouldStop())
     return;
 
   // Copy shared data under lock
-  std::shared_ptr<juce::AudioBuffer<float>> localBuffer;
-  double localSampleRate;
+  std::shared_ptr<const SampleStore> localStore;
   {
     juce::ScopedLock lock(analysisMutex);
-    localBuffer = analysisBuffer;
-    localSampleRate = analysisSampleRate;
+    localStore = analysisStore;
   }
 
-  if (!localBuffer)
+  if (!localStore)
     return;
 
   // ======== DEBUG LOGGING ========
   DBG("=== Analysis Started ===");
-  DBG("Buffer size: " + juce::String(localBuffer->getNumSamples()));
-  DBG("Sample rate: " + juce::String(localSampleRate));
-  DBG("Channels: " + juce::String(localBuffer->getNumChannels()));
-
-  float rmsTotal = 0;
-  const float *data = localBuffer->getReadPointer(0);
-  for (int i = 0; i < localBuffer->getNumSamples(); i++)
-    rmsTotal += data[i] * data[i];
-  rmsTotal = sqrt(rmsTotal / localBuffer->getNumSamples());
-  DBG("Overall RMS: " + juce::String(rmsTotal));
+  DBG("Sample length: " + juce::String(localStore->getNumSamples()));
+  DBG("Sample rate: " + juce::String(localStore->getSampleRate()));
+  DBG("Channels: " + juce::String(localStore->getNumChannels()));
+  DBG("Memory mapped: " + juce::String(localStore->isMemoryMapped() ? "yes"
+                                                                     : "no"));
   // ======== END DEBUG ========
 
-  // BPM detection on background thread (not UI thread)
-  float bpm = detectBPMFromAudio(*localBuffer, localSampleRate);
-  detectedBPM.store(bpm);
+  // Tempo and beat detection on another background thread, alongside the
+  // transcription: both read a sample being decoded as it is decoded. Only
+  // done once per sample, the result being cached by the store.
+  const auto cachedTempo = localStore->getTempo();
+  std::future<TempoDetector::Result> tempoDetection;
+  if (cachedTempo == nullptr)
+    tempoDetection = std::async(std::launch::async, [localStore, shouldStop] {
+      return TempoDetector::detect(*localStore, shouldStop);
+    });
+
+  // Transcription is sharded over this many threads
+  pitchDetector.setNumThreads(numAnalysisThreads.load());
+  pitchDetector.setParameters(noteSensitivity.load(), splitSensitivity.load());
+
+  auto notes = analyzeSample(*localStore);
+
+  const TempoDetector::Result tempo =
+      cachedTempo != nullptr ? *cachedTempo : tempoDetection.get();
+
+  // Cancelled: results are partial
+  if (shouldStop())
+    return;
+
+  if (cachedTempo == nullptr)
+    localStore->setTempo(std::make_shared<const TempoDetector::Result>(tempo));
+
+  const double beatPeriod = 60.0 / tempo.bpm;
+  detectedBPM.store(tempo.bpm);
+  detectedBeatOffset.store(
+      tempo.beatTimes.empty()
+          ? 0.0
+          : std::fmod(tempo.beatTimes.front(), beatPeriod));
   juce::Logger::writeToLog("BPM detected on background thread: " +
-                           juce::String(bpm));
+                           juce::String(tempo.bpm) + " (" +
+                           juce::String((int)tempo.beatTimes.size()) +
+                           " beats)");
 
-  auto notes = analyzeBuffer(*localBuffer, localSampleRate);
+  // Pitch class profile of the transcription, for key detection
+  {
+    juce::ScopedLock lock(analysisMutex);
+    if (analysisStore == localStore) {
+      analysisChroma = pitchDetector.getChroma();
+      hasAnalysisChroma = true;
+    }
+  }
 
   // ======== DEBUG LOGGING ========
-  DBG("Notes after analyzeBuffer: " + juce::String(notes.size()));
+  DBG("Notes after analyzeSample: " + juce::String(notes.size()));
   // ======== END DEBUG ========
 
-  if (shouldStopAnalysis || analysisThread->threadShouldExit())
+#if SAMPLE2MIDI_TRACE
+  for (const auto &stage : getTraceTotals())
+    juce::Logger::writeToLog(
+        "Trace " + juce::String(stage.name) + ": " +
+        juce::String(stage.totalUs / 1000.0, 1) + " ms, " +
+        juce::String(stage.frames) + " frames, " +
+        juce::String(stage.bytes) + " bytes (" +
+        juce::String(stage.numEvents) + " events)");
+#endif
+
+  if (shouldStop())
     return;
   juce::MessageManager::callAsync([this, notes]() mutable {
     detectedNotes = std::move(notes);
+    filteredNotes.clear();
     if (analysisCallback)
       analysisCallback((int)detectedNotes.size());
     if (auto *editor = getActiveEditor())
@@ -1,8 +1,12 @@
 #pragma once
 #include "AudioFileLoader.h"
+#include "LiveTranscriber.h"
 #include "MidiBuilder.h"
 #include "PitchDetector.h"
+#include "SampleStore.h"
 #include "ScaleQuantizer.h"
+#include "Trace.h"
+#include <array>
 #include <atomic>
 #include <functional>
 #include <juce_audio_formats/juce_audio_formats.h>
@@ -45,16 +49,24 @@ public:
                       std::function<void(int noteCount)> onComplete = nullptr,
                       std::function<void()> onLoadComplete = nullptr);
 
-  /** Manually trigger the sample-to-MIDI analysis */
+  /** Manually trigger the sample-to-MIDI analysis. A running analysis is
+   *  cancelled without waiting for it: the new one starts once it stops. */
   void processSample();
 
+  /** Progress of the running analysis in [0, 1]. Lock-free, for polling from
+   *  the editor. */
+  float getAnalysisProgress() const;
+
+  /** True while an analysis is running (message thread only). */
+  bool isAnalysisRunning() const;
+
   const std::vector<MidiNote> &getDetectedNotes() const {
     return detectedNotes;
   }
   double getCurrentSampleRate() const { return currentSampleRate; }
   juce::AudioFormatManager &getFormatManager() { return formatManager; }
-  std::shared_ptr<juce::AudioBuffer<float>> getAudioBuffer() {
-    return storedAudioBuffer;
+  std::shared_ptr<const SampleStore> getSampleStore() const {
+    return sampleStore;
   }
 
   // -----------------------------------------------------------------------
@@ -74,29 +86,103 @@ public:
   /** Save the detected notes to a .mid file chosen by the user. */
   void exportMidiToFile();
 
+  /** Notes kept in the note editor, exported instead of all detected notes. */
+  void setFilteredNotes(std::vector<MidiNote> notes);
+
+  // -----------------------------------------------------------------------
+  // Key / tempo detection
+  // -----------------------------------------------------------------------
+
+  /** Detect the key of the loaded sample, e.g. "A Minor". Empty if unknown. */
+  juce::String detectScaleFromAudio();
+
+  /** Tempo detected during the last analysis */
+  std::atomic<float> detectedBPM{120.0f};
+
+  /** Time of the first detected beat modulo the beat period, in seconds.
+   *  Exports are aligned on it so that beats fall on the MIDI grid. */
+  std::atomic<double> detectedBeatOffset{0.0};
+
+  /** Set from the editor when chord mode is toggled */
+  std::atomic<bool> chordModeActive{false};
+
+  // -----------------------------------------------------------------------
+  // Transcription parameters
+  // -----------------------------------------------------------------------
+
+  /** Same meaning as BasicPitch::setParameters. Applied at once to live mode
+   *  and to the next analysis. */
+  void setTranscriptionParameters(float noteSensitivity,
+                                  float splitSensitivity);
+
+  // -----------------------------------------------------------------------
+  // Analysis threads
+  // -----------------------------------------------------------------------
+
+  /** Number of threads the transcription of a sample is sharded over. */
+  void setNumAnalysisThreads(int numThreads);
+  int getNumAnalysisThreads() const;
+
+  // -----------------------------------------------------------------------
+  // Live mode
+  // -----------------------------------------------------------------------
+
+  /** Transcribe the plugin input to MIDI output in real time. The latency of
+   *  the transcription is reported to the host while enabled. */
+  void setLiveModeEnabled(bool shouldBeEnabled);
+  bool isLiveModeEnabled() const;
+
+  // -----------------------------------------------------------------------
+  // Tracing (compiled in with SAMPLE2MIDI_ENABLE_TRACE)
+  // -----------------------------------------------------------------------
+
+  /** Time, bytes and frames per stage since the last loaded file. Empty when
+   *  tracing is compiled out. */
+  std::vector<Trace::StageTotals> getTraceTotals() const;
+
+  /** Write the stage events since the last loaded file as Chrome trace JSON
+   *  (chrome://tracing, Perfetto). */
+  bool writeTrace(const juce::File &file) const;
+
 private:
-  std::vector<MidiNote> analyzeBuffer(const juce::AudioBuffer<float> &buffer,
-                                      double sampleRate);
+  std::vector<MidiNote> analyzeSample(const SampleStore &store);
 
   juce::AudioFormatManager formatManager;
   std::vector<MidiNote> detectedNotes;
+  std::vector<MidiNote> filteredNotes;
   double currentSampleRate = 44100.0;
 
-  // Stored audio buffer for re-analysis (scale/BPM detection)
-  std::shared_ptr<juce::AudioBuffer<float>> storedAudioBuffer;
+  // Loaded sample, shared by the analysis, the preview transport and the
+  // displays
+  std::shared_ptr<const SampleStore> sampleStore;
 
   // Thread safety for analysis
-  std::atomic<bool> shouldStopAnalysis{false};
+  std::atomic<int> numAnalysisThreads{1};
+  std::atomic<float> noteSensitivity{PitchDetector::kDefaultNoteSensitivity};
+  std::atomic<float> splitSensitivity{PitchDetector::kDefaultSplitSensitivity};
   juce::CriticalSection analysisMutex;
 
   class AnalysisThread : public juce::Thread {
   public:
-    AnalysisThread(Sample2MidiAudioProcessor &p)
-        : juce::Thread("AnalysisThread"), processor(p) {}
-    void run() override { processor.runAnalysisInternal(); }
+    AnalysisThread(Sample2MidiAudioProcessor &p,
+                   std::unique_ptr<AnalysisThread> previousThread)
+        : juce::Thread("AnalysisThread"), processor(p),
+          previous(std::move(previousThread)) {}
+
+    void run() override {
+      // A cancelled analysis uses the pitch detector until its next
+      // cancellation checkpoint
+      if (previous != nullptr) {
+        previous->waitForThreadToExit(-1);
+        previous = nullptr;
+      }
+
+      processor.runAnalysisInternal();
+    }
 
   private:
     Sample2MidiAudioProcessor &processor;
+    std::unique_ptr<AnalysisThread> previous;
   };
   std::unique_ptr<AnalysisThread> analysisThread;
 
@@ -104,14 +190,17 @@ private:
   void runAnalysisInternal();
 
   // Shared data for analysis thread
-  std::shared_ptr<juce::AudioBuffer<float>> analysisBuffer;
-  double analysisSampleRate = 44100.0;
+  std::shared_ptr<const SampleStore> analysisStore;
+  // Pitch class profile of the last transcription of analysisStore
+  std::array<float, 12> analysisChroma{};
+  bool hasAnalysisChroma = false;
   std::function<void(int)> analysisCallback;
 
   PitchDetector pitchDetector;
   MidiBuilder midiBuilder;
   ScaleQuantizer scaleQuantizer;
   AudioFileLoader audioFileLoader;
+  LiveTranscriber liveTranscriber;
 
   // Playback
   std::unique_ptr<juce::AudioFormatReaderSource> readerSource;
@@ -0,0 +1,316 @@
+#include "PolyphaseResampler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <tuple>
+
+namespace {
+
+// Filter design: Kaiser windowed sinc, 16 zero crossings on each side at the
+// output rate and a cutoff slightly below the output Nyquist frequency.
+constexpr double kZeroCrossings = 16.0;
+constexpr double kRolloff = 0.94;
+constexpr double kKaiserBeta = 8.6;
+constexpr double kPi = 3.14159265358979323846;
+
+double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 64; ++k) {
+    const double t = x / (2.0 * k);
+    term *= t * t;
+    sum += term;
+    if (term < 1e-12 * sum)
+      break;
+  }
+  return sum;
+}
+
+bool isIntegerRate(double rate) {
+  return rate > 0.0 && std::abs(rate - std::round(rate)) < 1e-9;
+}
+
+} // namespace
+
+std::shared_ptr<const PolyphaseResampler::FilterTable>
+PolyphaseResampler::getTable(double sourceSampleRate, double targetSampleRate) {
+  bool exact = false;
+  int64_t upFactor = kFallbackPhases;
+  int64_t downFactor = 0;
+
+  if (isIntegerRate(sourceSampleRate) && isIntegerRate(targetSampleRate)) {
+    const auto source = (int64_t)std::llround(sourceSampleRate);
+    const auto target = (int64_t)std::llround(targetSampleRate);
+    const auto g = std::gcd(source, target);
+
+    if (target / g <= kMaxExactPhases) {
+      exact = true;
+      upFactor = target / g;
+      downFactor = source / g;
+    }
+  }
+
+  const double ratio = sourceSampleRate / targetSampleRate;
+
+  // Key of the fallback tables: the ratio rounded to 1e-9
+  if (!exact)
+    downFactor = (int64_t)std::llround(ratio * 1e9);
+
+  static std::mutex cacheMutex;
+  static std::map<std::tuple<bool, int64_t, int64_t>,
+                  std::shared_ptr<const FilterTable>>
+      cache;
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+
+  auto &entry = cache[std::make_tuple(exact, upFactor, downFactor)];
+  if (entry == nullptr)
+    entry = buildTable(exact, upFactor, downFactor, ratio);
+
+  return entry;
+}
+
+std::shared_ptr<const PolyphaseResampler::FilterTable>
+PolyphaseResampler::buildTable(bool exact, int64_t upFactor,
+                               int64_t downFactor, double ratio) {
+  auto table = std::make_shared<FilterTable>();
+  table->exact = exact;
+  table->upFactor = upFactor;
+  table->downFactor = downFactor;
+  table->ratio = ratio;
+  table->numPhases = (int)upFactor;
+
+  // Cutoff in cycles per input sample (anti-aliasing when downsampling)
+  const double cutoff = 0.5 * std::min(1.0, 1.0 / ratio) * kRolloff;
+
+  // Half length in input samples, rounded so that numTaps is a multiple of 8
+  int halfTaps = (int)std::ceil(kZeroCrossings / (2.0 * cutoff));
+  halfTaps = (halfTaps + 3) / 4 * 4;
+
+  table->numTaps = 2 * halfTaps;
+  table->coefficients.resize((size_t)table->numPhases * table->numTaps);
+
+  const double windowNorm = besselI0(kKaiserBeta);
+
+  for (int phase = 0; phase < table->numPhases; ++phase) {
+    const double frac = (double)phase / table->numPhases;
+    float *row = table->coefficients.data() + (size_t)phase * table->numTaps;
+    double sum = 0.0;
+
+    for (int k = 0; k < table->numTaps; ++k) {
+      // Distance between input sample and output instant, in input samples
+      const double d = k - (halfTaps - 1) - frac;
+      const double x = d / halfTaps;
+
+      double value = 0.0;
+      if (std::abs(x) < 1.0) {
+        const double arg = 2.0 * cutoff * d;
+        const double sinc =
+            std::abs(arg) < 1e-12 ? 1.0 : std::sin(kPi * arg) / (kPi * arg);
+        const double window =
+            besselI0(kKaiserBeta * std::sqrt(1.0 - x * x)) / windowNorm;
+        value = 2.0 * cutoff * sinc * window;
+      }
+
+      row[k] = (float)value;
+      sum += value;
+    }
+
+    // Unity gain at DC for every phase
+    for (int k = 0; k < table->numTaps; ++k)
+      row[k] = (float)(row[k] / sum);
+  }
+
+  return table;
+}
+
+void PolyphaseResampler::prepare(double sourceSampleRate,
+                                 double targetSampleRate) {
+  assert(sourceSampleRate > 0.0 && targetSampleRate > 0.0);
+
+  if (table == nullptr || sourceSampleRate != preparedSourceRate ||
+      targetSampleRate != preparedTargetRate) {
+    table = getTable(sourceSampleRate, targetSampleRate);
+    preparedSourceRate = sourceSampleRate;
+    preparedTargetRate = targetSampleRate;
+    history.assign((size_t)(kBlockSize + 2 * table->numTaps), 0.0f);
+  }
+
+  reset();
+}
+
+void PolyphaseResampler::reset() {
+  assert(table != nullptr);
+
+  // Silence before the start of the input
+  const int halfTaps = table->numTaps / 2;
+  std::fill(history.begin(), history.begin() + halfTaps, 0.0f);
+  numHistory = halfTaps;
+  historyStart = -halfTaps;
+
+  numInputs = 0;
+  numOutputs = 0;
+}
+
+int64_t PolyphaseResampler::getNumOutputSamples(int64_t numInputSamples) const {
+  assert(table != nullptr);
+
+  if (table->exact)
+    return (numInputSamples * table->upFactor + table->downFactor - 1) /
+           table->downFactor;
+
+  return (int64_t)std::ceil(numInputSamples / table->ratio);
+}
+
+int PolyphaseResampler::getMaxOutputSamples(int numInputSamples) const {
+  assert(table != nullptr);
+  return (int)std::ceil((numInputSamples + table->numTaps) / table->ratio) + 1;
+}
+
+int PolyphaseResampler::getLookahead() const {
+  assert(table != nullptr);
+  return table->numTaps / 2;
+}
+
+void PolyphaseResampler::getPosition(int64_t n, int64_t &base,
+                                     int &phase) const {
+  if (table->exact) {
+    const int64_t position = n * table->downFactor;
+    base = position / table->upFactor;
+    phase = (int)(position % table->upFactor);
+    return;
+  }
+
+  const double t = n * table->ratio;
+  base = (int64_t)std::floor(t);
+  phase = (int)std::lround((t - base) * table->numPhases);
+
+  if (phase == table->numPhases) {
+    ++base;
+    phase = 0;
+  }
+}
+
+float PolyphaseResampler::dotProduct(const float *x, const float *h,
+                                     int numTaps) {
+  // 8 independent accumulators: vectorized by the compiler
+  float acc[8] = {};
+
+  for (int k = 0; k < numTaps; k += 8)
+    for (int j = 0; j < 8; ++j)
+      acc[j] += x[k + j] * h[k + j];
+
+  return ((acc[0] + acc[4]) + (acc[1] + acc[5])) +
+         ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+int PolyphaseResampler::produce(float *output, int64_t outputLimit) {
+  const int numTaps = table->numTaps;
+  const int halfTaps = numTaps / 2;
+  const int64_t available = historyStart + numHistory;
+  int written = 0;
+
+  while (numOutputs < outputLimit) {
+    int64_t base;
+    int phase;
+    getPosition(numOutputs, base, phase);
+
+    const int64_t first = base - halfTaps + 1;
+    if (first + numTaps > available)
+      break;
+
+    output[written++] =
+        dotProduct(history.data() + (first - historyStart),
+                   table->coefficients.data() + (size_t)phase * numTaps,
+                   numTaps);
+    ++numOutputs;
+  }
+
+  return written;
+}
+
+void PolyphaseResampler::compact() {
+  int64_t base;
+  int phase;
+  getPosition(numOutputs, base, phase);
+
+  const int64_t first = base - table->numTaps / 2 + 1;
+  const int drop =
+      (int)std::clamp<int64_t>(first - historyStart, 0, numHistory);
+
+  if (drop > 0) {
+    std::memmove(history.data(), history.data() + drop,
+                 (size_t)(numHistory - drop) * sizeof(float));
+    numHistory -= drop;
+    historyStart += drop;
+  }
+}
+
+int PolyphaseResampler::process(const float *const *channels, int numChannels,
+                                int numSamples, float *output) {
+  assert(table != nullptr);
+
+  const float gain = numChannels > 0 ? 1.0f / numChannels : 0.0f;
+  int written = 0;
+  int consumed = 0;
+
+  while (consumed < numSamples) {
+    compact();
+
+    const int blockSize = std::min(numSamples - consumed,
+                                   (int)history.size() - numHistory);
+    assert(blockSize > 0);
+
+    // Downmix straight into the history buffer
+    float *block = history.data() + numHistory;
+
+    if (numChannels == 0) {
+      std::fill(block, block + blockSize, 0.0f);
+    } else if (numChannels == 1) {
+      std::copy(channels[0] + consumed, channels[0] + consumed + blockSize,
+                block);
+    } else {
+      const float *left = channels[0] + consumed;
+      const float *right = channels[1] + consumed;
+      for (int i = 0; i < blockSize; ++i)
+        block[i] = left[i] + right[i];
+
+      for (int ch = 2; ch < numChannels; ++ch) {
+        const float *channel = channels[ch] + consumed;
+        for (int i = 0; i < blockSize; ++i)
+          block[i] += channel[i];
+      }
+
+      for (int i = 0; i < blockSize; ++i)
+        block[i] *= gain;
+    }
+
+    numHistory += blockSize;
+    numInputs += blockSize;
+    consumed += blockSize;
+
+    written += produce(output + written, std::numeric_limits<int64_t>::max());
+  }
+
+  return written;
+}
+
+int PolyphaseResampler::finish(float *output) {
+  assert(table != nullptr);
+
+  compact();
+
+  // Silence after the end of the input (one more sample for the rounding of
+  // the phase when the ratio is not exact)
+  const int numPadding = table->numTaps / 2 + 1;
+  std::fill(history.begin() + numHistory,
+            history.begin() + numHistory + numPadding, 0.0f);
+  numHistory += numPadding;
+
+  return produce(output, getNumOutputSamples(numInputs));
+}
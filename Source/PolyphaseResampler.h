@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Polyphase windowed-sinc resampler with fused channel downmix.
+//
+// The conversion ratio is reduced to targetRate/sourceRate = L/M. Output
+// sample n is computed from the input around position n * M / L with the
+// filter phase (n * M) % L, so each output only costs one dot product of
+// numTaps coefficients. When the reduced L is too large (or the rates are not
+// integers) the nearest of kFallbackPhases phases is used instead.
+//
+// Filter tables are built once per ratio and shared between instances.
+// Input is consumed in blocks: channels are averaged into a small history
+// buffer which is the only working memory, so whole signals and live streams
+// go through the same code.
+class PolyphaseResampler {
+public:
+  PolyphaseResampler() = default;
+
+  // Set the conversion and reset the stream. Allocates only when the ratio
+  // changes.
+  void prepare(double sourceSampleRate, double targetSampleRate);
+
+  // Restart a new stream with the same conversion.
+  void reset();
+
+  // Number of output samples of a whole signal of numInputSamples, i.e. the
+  // number of output instants before the end of the input.
+  int64_t getNumOutputSamples(int64_t numInputSamples) const;
+
+  // Upper bound of the number of samples written by process() for
+  // numInputSamples.
+  int getMaxOutputSamples(int numInputSamples) const;
+
+  // Average numChannels channels and resample them. output must have room for
+  // getMaxOutputSamples(numSamples) samples.
+  // Returns the number of output samples written.
+  int process(const float *const *channels, int numChannels, int numSamples,
+              float *output);
+
+  // End of stream: write the last output samples, computed with silence after
+  // the end of the input. output must have room for getMaxOutputSamples(0).
+  // Returns the number of output samples written.
+  int finish(float *output);
+
+  // Number of input samples the filter looks ahead.
+  int getLookahead() const;
+
+private:
+  struct FilterTable {
+    bool exact = true;
+    int64_t upFactor = 1;   // L
+    int64_t downFactor = 1; // M
+    double ratio = 1.0;     // Input samples per output sample
+    int numPhases = 1;
+    int numTaps = 0;
+    // numPhases rows of numTaps coefficients
+    std::vector<float> coefficients;
+  };
+
+  static std::shared_ptr<const FilterTable> getTable(double sourceSampleRate,
+                                                     double targetSampleRate);
+
+  static std::shared_ptr<const FilterTable>
+  buildTable(bool exact, int64_t upFactor, int64_t downFactor, double ratio);
+
+  // Input sample index and filter phase of output sample n
+  void getPosition(int64_t n, int64_t &base, int &phase) const;
+
+  // Compute output samples while their input is in the history buffer.
+  int produce(float *output, int64_t outputLimit);
+
+  // Drop history samples no longer needed by the next output sample.
+  void compact();
+
+  static float dotProduct(const float *x, const float *h, int numTaps);
+
+  static constexpr int kBlockSize = 4096;
+  static constexpr int kMaxExactPhases = 1024;
+  static constexpr int kFallbackPhases = 256;
+
+  std::shared_ptr<const FilterTable> table;
+  double preparedSourceRate = 0.0;
+  double preparedTargetRate = 0.0;
+
+  // Downmixed input, history[0] is input sample historyStart
+  std::vector<float> history;
+  int numHistory = 0;
+  int64_t historyStart = 0;
+
+  int64_t numInputs = 0;
+  int64_t numOutputs = 0;
+};
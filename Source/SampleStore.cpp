@@ -0,0 +1,244 @@
+#include "SampleStore.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+// AudioFormatReader over a SampleStore. Holds its own channel pointer array so
+// that reads do not allocate (a reader is used by one thread at a time).
+class SampleStore::Reader : public juce::AudioFormatReader {
+public:
+  explicit Reader(std::shared_ptr<const SampleStore> storeToUse)
+      : juce::AudioFormatReader(nullptr, "SampleStore"),
+        store(std::move(storeToUse)),
+        channelPointers((size_t)store->getNumChannels(), nullptr) {
+    sampleRate = store->getSampleRate();
+    numChannels = (unsigned int)store->getNumChannels();
+    lengthInSamples = store->getNumSamples();
+    bitsPerSample = 32;
+    usesFloatingPointData = true;
+  }
+
+  bool readSamples(int *const *destChannels, int numDestChannels,
+                   int startOffsetInDestBuffer, juce::int64 startSampleInFile,
+                   int numSamples) override {
+    const int numRead = std::min(numDestChannels, (int)channelPointers.size());
+
+    for (int ch = 0; ch < numRead; ++ch)
+      channelPointers[(size_t)ch] =
+          destChannels[ch] != nullptr
+              ? reinterpret_cast<float *>(destChannels[ch]) +
+                    startOffsetInDestBuffer
+              : nullptr;
+
+    store->read(channelPointers.data(), numRead, startSampleInFile,
+                numSamples);
+
+    for (int ch = numRead; ch < numDestChannels; ++ch)
+      if (destChannels[ch] != nullptr)
+        juce::FloatVectorOperations::clear(
+            reinterpret_cast<float *>(destChannels[ch]) +
+                startOffsetInDestBuffer,
+            numSamples);
+
+    return true;
+  }
+
+private:
+  std::shared_ptr<const SampleStore> store;
+  std::vector<float *> channelPointers;
+};
+
+std::shared_ptr<SampleStore>
+SampleStore::open(const juce::File &file,
+                  juce::AudioFormatManager &formatManager) {
+  TRACE_SCOPE(scope, "load");
+
+  std::shared_ptr<SampleStore> store(new SampleStore());
+  store->file = file;
+
+  // PCM WAV / AIFF: map the file
+  if (auto *format =
+          formatManager.findFormatForFileExtension(file.getFileExtension())) {
+    std::unique_ptr<juce::MemoryMappedAudioFormatReader> mapped(
+        format->createMemoryMappedReader(file));
+
+    if (mapped != nullptr && mapped->mapEntireFile() &&
+        mapped->lengthInSamples > 0) {
+      store->sampleRate = mapped->sampleRate;
+      store->numChannels = (int)mapped->numChannels;
+      store->numSamples = mapped->lengthInSamples;
+      TRACE_FRAMES(scope, mapped->lengthInSamples);
+      store->mappedReader = std::move(mapped);
+      store->complete = true;
+      return store;
+    }
+  }
+
+  // Compressed formats: decoded once by decode()
+  std::unique_ptr<juce::AudioFormatReader> reader(
+      formatManager.createReaderFor(file));
+
+  if (reader == nullptr || reader->lengthInSamples <= 0 ||
+      reader->lengthInSamples > std::numeric_limits<int>::max())
+    return nullptr;
+
+  store->sampleRate = reader->sampleRate;
+  store->numChannels = (int)reader->numChannels;
+  store->numSamples = reader->lengthInSamples;
+  store->decoded.setSize(store->numChannels, (int)reader->lengthInSamples);
+  TRACE_FRAMES(scope, reader->lengthInSamples);
+  TRACE_BYTES(scope, store->decoded.getNumChannels() *
+                         store->decoded.getNumSamples() * sizeof(float));
+  store->decoder = std::move(reader);
+
+  return store;
+}
+
+void SampleStore::decode(const std::function<bool()> &shouldStop) {
+  if (decoder == nullptr)
+    return;
+
+  TRACE_SCOPE(scope, "decode");
+
+  const int64_t length = numSamples.load();
+  int64_t position = 0;
+
+  while (position < length && !(shouldStop && shouldStop())) {
+    const int num = (int)std::min<int64_t>(kDecodeBlockSize, length - position);
+    decoder->read(&decoded, (int)position, num, position, true, true);
+    position += num;
+
+    {
+      std::lock_guard<std::mutex> lock(decodeMutex);
+      numDecoded.store(position, std::memory_order_release);
+    }
+    decodeCondition.notify_all();
+  }
+
+  decoder.reset();
+  TRACE_FRAMES(scope, position);
+
+  {
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    numSamples = position;
+    complete = true;
+  }
+  decodeCondition.notify_all();
+}
+
+int64_t
+SampleStore::waitForSamples(int64_t numSamplesWanted,
+                            const std::function<bool()> &shouldStop) const {
+  std::unique_lock<std::mutex> lock(decodeMutex);
+
+  // The decoder only signals new blocks: shouldStop is polled
+  while (!complete.load() && numDecoded.load() < numSamplesWanted &&
+         !(shouldStop && shouldStop()))
+    decodeCondition.wait_for(lock, std::chrono::milliseconds(kStopPollMs));
+
+  return numDecoded.load(std::memory_order_acquire);
+}
+
+void SampleStore::read(float *const *dest, int numDestChannels,
+                       int64_t startSample, int numSamplesToRead) const {
+  if (mappedReader != nullptr) {
+    // Same as AudioFormatReader::read into an AudioBuffer<float>: integer
+    // formats are read as 32 bit fixed point and converted in place
+    mappedReader->read(reinterpret_cast<int *const *>(dest), numDestChannels,
+                       startSample, numSamplesToRead, false);
+
+    if (!mappedReader->usesFloatingPointData)
+      for (int ch = 0; ch < numDestChannels; ++ch)
+        if (dest[ch] != nullptr)
+          juce::FloatVectorOperations::convertFixedToFloat(
+              dest[ch], reinterpret_cast<const int *>(dest[ch]),
+              1.0f / (float)0x7fffffff, numSamplesToRead);
+    return;
+  }
+
+  // Part of [startSample, startSample + numSamplesToRead) already decoded
+  const int64_t available = numDecoded.load(std::memory_order_acquire);
+  const int64_t begin = juce::jlimit<int64_t>(0, available, startSample);
+  const int64_t end =
+      juce::jlimit<int64_t>(0, available, startSample + numSamplesToRead);
+  const int offset = (int)(begin - startSample);
+  const int numAvailable = (int)(end - begin);
+
+  for (int ch = 0; ch < numDestChannels; ++ch) {
+    float *channel = dest[ch];
+    if (channel == nullptr)
+      continue;
+
+    if (ch >= numChannels || numAvailable <= 0) {
+      juce::FloatVectorOperations::clear(channel, numSamplesToRead);
+      continue;
+    }
+
+    juce::FloatVectorOperations::clear(channel, offset);
+    juce::FloatVectorOperations::copy(channel + offset,
+                                      decoded.getReadPointer(ch, (int)begin),
+                                      numAvailable);
+    juce::FloatVectorOperations::clear(channel + offset + numAvailable,
+                                       numSamplesToRead - offset -
+                                           numAvailable);
+  }
+}
+
+void SampleStore::forEachBlock(const BlockCallback &callback, int blockSize,
+                               const std::function<bool()> &shouldStop) const {
+  auto stopped = [&] { return shouldStop && shouldStop(); };
+
+  if (mappedReader == nullptr) {
+    // Decoded samples are given in place, as soon as they are decoded
+    std::vector<const float *> channels((size_t)numChannels);
+
+    for (int64_t start = 0;; start += blockSize) {
+      const int64_t available = waitForSamples(start + blockSize, shouldStop);
+      if (stopped() || start >= available)
+        break;
+
+      const int num = (int)std::min<int64_t>(blockSize, available - start);
+      for (int ch = 0; ch < numChannels; ++ch)
+        channels[(size_t)ch] = decoded.getReadPointer(ch, (int)start);
+      callback(channels.data(), numChannels, num);
+    }
+    return;
+  }
+
+  juce::AudioBuffer<float> block(numChannels, blockSize);
+  const int64_t length = numSamples.load();
+
+  for (int64_t start = 0; start < length && !stopped(); start += blockSize) {
+    const int num = (int)std::min<int64_t>(blockSize, length - start);
+    read(block.getArrayOfWritePointers(), numChannels, start, num);
+    callback(block.getArrayOfReadPointers(), numChannels, num);
+  }
+}
+
+std::unique_ptr<juce::AudioFormatReader> SampleStore::createReader() const {
+  return std::make_unique<Reader>(shared_from_this());
+}
+
+std::shared_ptr<const std::vector<float>>
+SampleStore::getAnalysisSignal() const {
+  std::lock_guard<std::mutex> lock(derivedDataMutex);
+  return analysisSignal;
+}
+
+void SampleStore::setAnalysisSignal(
+    std::shared_ptr<const std::vector<float>> signal) const {
+  std::lock_guard<std::mutex> lock(derivedDataMutex);
+  analysisSignal = std::move(signal);
+}
+
+std::shared_ptr<const TempoResult> SampleStore::getTempo() const {
+  std::lock_guard<std::mutex> lock(derivedDataMutex);
+  return tempo;
+}
+
+void SampleStore::setTempo(std::shared_ptr<const TempoResult> result) const {
+  std::lock_guard<std::mutex> lock(derivedDataMutex);
+  tempo = std::move(result);
+}
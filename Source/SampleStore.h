@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TempoResult;
+
+// Immutable samples of a loaded audio file, shared by the analysis, the
+// preview transport and the displays.
+//
+// PCM WAV and AIFF files are memory mapped: the samples stay in the page cache
+// of the file and are converted to float when read, so a sample costs no heap
+// memory whatever its size. Other formats (MP3, FLAC, Ogg) are decoded once
+// into a buffer owned by the store, block by block by decode(): the store can
+// be read while it is decoded, forEachBlock waiting for the blocks it reaches.
+//
+// All reads are const and can be made concurrently from any thread: the memory
+// mapped readers only read the mapping, and decoded samples are not written
+// again once published.
+class SampleStore : public std::enable_shared_from_this<SampleStore> {
+public:
+  // (channels, numChannels, numSamples) of consecutive blocks of the sample
+  using BlockCallback =
+      std::function<void(const float *const *, int, int)>;
+
+  // Open file, memory mapped if its format allows it. Returns nullptr if the
+  // file cannot be read. Files that cannot be mapped have no samples until
+  // decode() is called.
+  static std::shared_ptr<SampleStore>
+  open(const juce::File &file, juce::AudioFormatManager &formatManager);
+
+  // Decode the file into the store, publishing the samples block by block.
+  // Stops early if shouldStop returns true: the sample then ends after the
+  // last decoded block. Does nothing for memory mapped files.
+  void decode(const std::function<bool()> &shouldStop);
+
+  const juce::File &getFile() const { return file; }
+  double getSampleRate() const { return sampleRate; }
+  int getNumChannels() const { return numChannels; }
+  // Length given by the file header until decoding completes
+  int64_t getNumSamples() const { return numSamples.load(); }
+  bool isMemoryMapped() const { return mappedReader != nullptr; }
+  // True once all samples can be read (always for memory mapped files)
+  bool isComplete() const { return complete.load(); }
+
+  // Read numSamples samples from startSample into the first numDestChannels
+  // channels of dest. Null channels are skipped, samples outside of the file,
+  // samples not decoded yet and channels beyond getNumChannels() are zeros.
+  void read(float *const *dest, int numDestChannels, int64_t startSample,
+            int numSamples) const;
+
+  // Call callback on consecutive blocks of up to blockSize samples of all
+  // channels, from the start to the end of the sample. While the sample is
+  // being decoded, waits for each block to be decoded. Stops early once
+  // shouldStop (if any) returns true, checked between blocks and while
+  // waiting.
+  void forEachBlock(const BlockCallback &callback,
+                    int blockSize = kDefaultBlockSize,
+                    const std::function<bool()> &shouldStop = nullptr) const;
+
+  // Reader of the store, e.g. for an AudioFormatReaderSource or an
+  // AudioThumbnail. The reader keeps the store alive.
+  std::unique_ptr<juce::AudioFormatReader> createReader() const;
+
+  // Mono 22.05 kHz signal of the sample for the neural model, derived by its
+  // first transcription and cached so that later ones do not convert the
+  // samples again. Null until then.
+  std::shared_ptr<const std::vector<float>> getAnalysisSignal() const;
+  void
+  setAnalysisSignal(std::shared_ptr<const std::vector<float>> signal) const;
+
+  // Tempo and beats of the sample (TempoDetector), cached the same way by its
+  // first complete analysis. Null until then.
+  std::shared_ptr<const TempoResult> getTempo() const;
+  void setTempo(std::shared_ptr<const TempoResult> result) const;
+
+  static constexpr int kDefaultBlockSize = 8192;
+
+private:
+  SampleStore() = default;
+
+  class Reader;
+
+  // Wait until at least numSamplesWanted samples are decoded, decoding is
+  // complete or shouldStop returns true. Returns the number of decoded
+  // samples.
+  int64_t waitForSamples(int64_t numSamplesWanted,
+                         const std::function<bool()> &shouldStop) const;
+
+  // Samples decoded between two publications
+  static constexpr int kDecodeBlockSize = 32768;
+  // Interval at which shouldStop is polled while waiting for samples
+  static constexpr int kStopPollMs = 20;
+
+  juce::File file;
+  double sampleRate = 0.0;
+  int numChannels = 0;
+  std::atomic<int64_t> numSamples{0};
+
+  // Either the memory mapped reader or the decoded samples
+  std::unique_ptr<juce::MemoryMappedAudioFormatReader> mappedReader;
+  juce::AudioBuffer<float> decoded;
+
+  // Decoding state. Samples [0, numDecoded) of decoded are final.
+  std::unique_ptr<juce::AudioFormatReader> decoder;
+  std::atomic<int64_t> numDecoded{0};
+  std::atomic<bool> complete{false};
+  mutable std::mutex decodeMutex;
+  mutable std::condition_variable decodeCondition;
+
+  // Derived from the samples, so cached even on a const store
+  mutable std::mutex derivedDataMutex;
+  mutable std::shared_ptr<const std::vector<float>> analysisSignal;
+  mutable std::shared_ptr<const TempoResult> tempo;
+};
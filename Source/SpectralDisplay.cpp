@@ -35,15 +35,36 @@ void SpectralDisplay::pushBuffer(const float *data, int numSamples) {
 
 void SpectralDisplay::setAudioData(const float *data, int numSamples,
                                    double rate) {
+  resetAnalysis(rate);
+
+  // Push entire buffer through FFT
+  pushBuffer(data, numSamples);
+
+  updateMagnitudes();
+}
+
+void SpectralDisplay::setAudioData(const SampleStore &store) {
+  resetAnalysis(store.getSampleRate());
+
+  // Push entire sample through FFT
+  store.forEachBlock(
+      [this](const float *const *channels, int numChannels, int numSamples) {
+        if (numChannels > 0)
+          pushBuffer(channels[0], numSamples);
+      });
+
+  updateMagnitudes();
+}
+
+void SpectralDisplay::resetAnalysis(double rate) {
   sampleRate = rate;
   magnitudes.resize(128, 0.0f);
   fifoIndex = 0;
   nextFFTBlockReady = false;
   fifo.fill(0);
+}
 
-  // Push entire buffer through FFT
-  pushBuffer(data, numSamples);
-
+void SpectralDisplay::updateMagnitudes() {
   // Copy scopeData to magnitudes for display (use first 128 bins)
   for (int i = 0; i < 128 && i < fftSize; i++) {
     magnitudes[i] = scopeData[i];
@@ -1,4 +1,5 @@
 #pragma once
+#include "SampleStore.h"
 #include <array>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_dsp/juce_dsp.h>
@@ -11,6 +12,8 @@ public:
   SpectralDisplay();
 
   void setAudioData(const float *data, int numSamples, double sampleRate);
+  // Same with the first channel of a sample, read block by block
+  void setAudioData(const SampleStore &store);
   void paint(juce::Graphics &g) override;
 
   juce::String getDetectedChord() const { return currentChord; }
@@ -23,6 +26,8 @@ public:
   void pushBuffer(const float *data, int numSamples);
 
 private:
+  void resetAnalysis(double sampleRate);
+  void updateMagnitudes();
   void performFFT();
   void detectChord();
   juce::String freqToNoteName(float freq) const;
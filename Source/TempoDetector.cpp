@@ -0,0 +1,300 @@
+#include "TempoDetector.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Gain applied to magnitudes before log compression of the spectrum
+constexpr float kLogCompression = 1000.0f;
+
+} // namespace
+
+void TempoDetector::prepare(double inSampleRate, int64_t expectedNumSamples) {
+  sampleRate = inSampleRate > 0.0 ? inSampleRate : 44100.0;
+
+  int order = 1;
+  while ((1 << order) < (int)std::lround(kFrameSeconds * sampleRate))
+    ++order;
+
+  if (fft == nullptr || fft->getSize() != (1 << order)) {
+    fft = std::make_unique<juce::dsp::FFT>(order);
+    frameSize = 1 << order;
+
+    window.resize((size_t)frameSize);
+    juce::dsp::WindowingFunction<float>::fillWindowingTables(
+        window.data(), (size_t)frameSize,
+        juce::dsp::WindowingFunction<float>::hann, false);
+
+    frame.assign((size_t)frameSize, 0.0f);
+    spectrum.assign((size_t)frameSize * 2, 0.0f);
+    previousLogMagnitudes.assign((size_t)frameSize / 2 + 1, 0.0f);
+  }
+
+  hopSize = frameSize / kHopDivision;
+  maxLag = (int)std::ceil(kMaxLagSeconds * sampleRate / hopSize);
+  envelopeRing.assign((size_t)maxLag + 1, 0.0f);
+  autocorrelation.assign((size_t)maxLag + 1, 0.0);
+
+  if (expectedNumSamples > 0)
+    envelope.reserve((size_t)(expectedNumSamples / hopSize + 2));
+
+  reset();
+}
+
+void TempoDetector::reset() {
+  // Half a frame of silence before the signal: frame i is centred on sample
+  // i * hopSize
+  std::fill(frame.begin(), frame.end(), 0.0f);
+  numInFrame = frameSize / 2;
+  hasPreviousFrame = false;
+
+  envelope.clear();
+  std::fill(envelopeRing.begin(), envelopeRing.end(), 0.0f);
+  std::fill(autocorrelation.begin(), autocorrelation.end(), 0.0);
+  envelopeSum = 0.0;
+}
+
+void TempoDetector::process(const float *const *channels, int numChannels,
+                            int numSamples) {
+  jassert(fft != nullptr);
+
+  for (int offset = 0; offset < numSamples;) {
+    const int num = std::min(numSamples - offset, frameSize - numInFrame);
+    float *dest = frame.data() + numInFrame;
+
+    if (numChannels == 0) {
+      juce::FloatVectorOperations::clear(dest, num);
+    } else {
+      juce::FloatVectorOperations::copy(dest, channels[0] + offset, num);
+      for (int ch = 1; ch < numChannels; ++ch)
+        juce::FloatVectorOperations::add(dest, channels[ch] + offset, num);
+      if (numChannels > 1)
+        juce::FloatVectorOperations::multiply(dest, 1.0f / numChannels, num);
+    }
+
+    numInFrame += num;
+    offset += num;
+
+    if (numInFrame == frameSize) {
+      analyzeFrame();
+      std::memmove(frame.data(), frame.data() + hopSize,
+                   (size_t)(frameSize - hopSize) * sizeof(float));
+      numInFrame -= hopSize;
+    }
+  }
+}
+
+void TempoDetector::analyzeFrame() {
+  juce::FloatVectorOperations::multiply(spectrum.data(), frame.data(),
+                                        window.data(), frameSize);
+  std::fill(spectrum.begin() + frameSize, spectrum.end(), 0.0f);
+  fft->performFrequencyOnlyForwardTransform(spectrum.data(), true);
+
+  const int numBins = frameSize / 2 + 1;
+  float flux = 0.0f;
+
+  for (int bin = 0; bin < numBins; ++bin) {
+    const float logMagnitude = std::log1p(kLogCompression * spectrum[bin]);
+    flux += std::max(0.0f, logMagnitude - previousLogMagnitudes[bin]);
+    previousLogMagnitudes[bin] = logMagnitude;
+  }
+
+  // No increase can be measured on the first frame
+  if (!hasPreviousFrame) {
+    flux = 0.0f;
+    hasPreviousFrame = true;
+  }
+
+  envelope.push_back(flux);
+  accumulateAutocorrelation(flux);
+}
+
+void TempoDetector::accumulateAutocorrelation(float value) {
+  const int ringSize = maxLag + 1;
+  const auto t = (int64_t)envelope.size() - 1;
+  const int position = (int)(t % ringSize);
+
+  envelopeRing[(size_t)position] = value;
+  envelopeSum += value;
+
+  // Lag l pairs value with the value l positions before in the ring
+  const int numLags = (int)std::min<int64_t>(maxLag, t) + 1;
+  const int numBeforeWrap = std::min(numLags, position + 1);
+
+  for (int lag = 0; lag < numBeforeWrap; ++lag)
+    autocorrelation[(size_t)lag] +=
+        (double)value * envelopeRing[(size_t)(position - lag)];
+
+  for (int lag = numBeforeWrap; lag < numLags; ++lag)
+    autocorrelation[(size_t)lag] +=
+        (double)value * envelopeRing[(size_t)(position - lag + ringSize)];
+}
+
+double TempoDetector::estimatePeriod() const {
+  const auto numFrames = (int64_t)envelope.size();
+  const double framesPerMinute = 60.0 * sampleRate / hopSize;
+  const int minPeriod = (int)std::floor(framesPerMinute / kMaxBpm);
+  const int maxPeriod = (int)std::ceil(framesPerMinute / kMinBpm);
+
+  // At least two beats at the slowest tempo
+  if (numFrames < 2 * maxPeriod)
+    return 0.0;
+
+  const double mean = envelopeSum / (double)numFrames;
+
+  // Autocorrelation of the envelope minus its mean, per pair of frames
+  auto centredAutocorrelation = [&](int lag) {
+    const auto numPairs = numFrames - lag;
+    if (lag > maxLag || numPairs <= 0)
+      return 0.0;
+    return autocorrelation[(size_t)lag] / (double)numPairs - mean * mean;
+  };
+
+  // Comb filtered tempogram weighted by the tempo prior
+  std::vector<double> scores((size_t)(maxPeriod - minPeriod + 1), 0.0);
+
+  for (int period = std::max(minPeriod, 1); period <= maxPeriod; ++period) {
+    double comb = 0.0;
+    for (int k = 1; k <= kCombHarmonics; ++k)
+      comb += centredAutocorrelation(k * period) / k;
+
+    const double octaves = std::log2(framesPerMinute / period / kPriorBpm);
+    const double prior =
+        std::exp(-0.5 * octaves * octaves / (kPriorOctaves * kPriorOctaves));
+
+    scores[(size_t)(period - minPeriod)] = prior * comb;
+  }
+
+  const auto best = std::max_element(scores.begin(), scores.end());
+  if (*best <= 0.0)
+    return 0.0;
+
+  const auto index = (int)(best - scores.begin());
+  double period = minPeriod + index;
+
+  // Parabolic interpolation of the peak
+  if (index > 0 && index + 1 < (int)scores.size()) {
+    const double left = scores[(size_t)index - 1];
+    const double right = scores[(size_t)index + 1];
+    const double curvature = left - 2.0 * *best + right;
+    if (curvature < 0.0)
+      period += 0.5 * (left - right) / curvature;
+  }
+
+  return period;
+}
+
+std::vector<int> TempoDetector::trackBeats(double period) const {
+  const int numFrames = (int)envelope.size();
+
+  // Onset strength in units of its standard deviation
+  const double mean = envelopeSum / numFrames;
+  double variance = 0.0;
+  for (float value : envelope)
+    variance += (value - mean) * (value - mean);
+  const double deviation = std::sqrt(variance / numFrames);
+  if (deviation <= 0.0)
+    return {};
+
+  // Previous beat searched between half and twice the period before
+  const int minInterval = std::max(1, (int)std::lround(0.5 * period));
+  const int maxInterval = (int)std::lround(2.0 * period);
+
+  std::vector<double> transitionCost((size_t)(maxInterval + 1), 0.0);
+  for (int interval = minInterval; interval <= maxInterval; ++interval) {
+    const double deviationLog = std::log(interval / period);
+    transitionCost[(size_t)interval] = kTightness * deviationLog * deviationLog;
+  }
+
+  std::vector<double> score((size_t)numFrames);
+  std::vector<int> backlink((size_t)numFrames, -1);
+
+  for (int t = 0; t < numFrames; ++t) {
+    double bestPrevious = 0.0;
+    int bestFrame = -1;
+
+    for (int interval = minInterval;
+         interval <= maxInterval && interval <= t; ++interval) {
+      const double candidate = score[(size_t)(t - interval)] -
+                               transitionCost[(size_t)interval];
+      if (bestFrame < 0 || candidate > bestPrevious) {
+        bestPrevious = candidate;
+        bestFrame = t - interval;
+      }
+    }
+
+    score[(size_t)t] = envelope[(size_t)t] / deviation +
+                       (bestFrame >= 0 ? bestPrevious : 0.0);
+    backlink[(size_t)t] = bestFrame;
+  }
+
+  // Last beat: best score within the last period
+  const int searchStart =
+      std::max(0, numFrames - (int)std::lround(period));
+  int frame = (int)(std::max_element(score.begin() + searchStart,
+                                     score.end()) -
+                    score.begin());
+
+  std::vector<int> beats;
+  for (; frame >= 0; frame = backlink[(size_t)frame])
+    beats.push_back(frame);
+  std::reverse(beats.begin(), beats.end());
+
+  // Drop the beats placed in the silence before the first and after the last
+  // onsets: their onset strength is well below the typical one of the beats.
+  double sumSquares = 0.0;
+  for (int beat : beats)
+    sumSquares += (double)envelope[(size_t)beat] * envelope[(size_t)beat];
+  const double threshold = 0.5 * std::sqrt(sumSquares / beats.size());
+
+  auto isWeak = [&](int beat) { return envelope[(size_t)beat] < threshold; };
+  const auto first = std::find_if_not(beats.begin(), beats.end(), isWeak);
+  const auto last = std::find_if_not(beats.rbegin(), beats.rend(), isWeak);
+  if (first == beats.end())
+    return {};
+
+  return std::vector<int>(first, last.base());
+}
+
+TempoDetector::Result TempoDetector::finish() {
+  Result result;
+
+  const double period = estimatePeriod();
+  if (period <= 0.0)
+    return result;
+
+  result.bpm = (float)(60.0 * sampleRate / (hopSize * period));
+
+  for (int beat : trackBeats(period))
+    result.beatTimes.push_back((double)beat * hopSize / sampleRate);
+
+  return result;
+}
+
+TempoDetector::Result
+TempoDetector::detect(const SampleStore &store,
+                      const std::function<bool()> &shouldStop) {
+  if (store.getNumSamples() == 0 || store.getSampleRate() <= 0)
+    return {};
+
+  TRACE_SCOPE(scope, "bpm");
+  TRACE_FRAMES(scope, store.getNumSamples());
+
+  TempoDetector detector;
+  detector.prepare(store.getSampleRate(), store.getNumSamples());
+  TRACE_BYTES(scope, detector.envelope.capacity() * sizeof(float));
+  store.forEachBlock(
+      [&detector](const float *const *channels, int numChannels,
+                  int numSamples) {
+        detector.process(channels, numChannels, numSamples);
+      },
+      SampleStore::kDefaultBlockSize, shouldStop);
+
+  if (shouldStop && shouldStop())
+    return {};
+
+  return detector.finish();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "SampleStore.h"
+#include <cstdint>
+#include <functional>
+#include <juce_dsp/juce_dsp.h>
+#include <memory>
+#include <vector>
+
+struct TempoResult;
+
+// Tempo and beat tracker working in a single streaming pass.
+//
+// Input blocks are downmixed into a short analysis frame (~46 ms, hop ~11.6
+// ms). Each frame adds one value to the onset envelope: the spectral flux,
+// i.e. the sum of the increases of the log magnitude spectrum since the
+// previous frame. The autocorrelation of the envelope over the lags of the
+// tempo range is accumulated as values arrive, from a ring of the last
+// kMaxLagSeconds of envelope, so processing a block does not allocate and
+// its working memory does not depend on the signal length.
+//
+// finish() picks the beat period on a comb-filtered tempogram weighted by a
+// tempo prior, then tracks beats on the envelope with dynamic programming
+// (Ellis, "Beat Tracking by Dynamic Programming", 2007). The envelope is the
+// only state growing with the signal, by one float per hop.
+class TempoDetector {
+public:
+  using Result = TempoResult;
+
+  TempoDetector() = default;
+
+  // Set the input sample rate and reset the stream. expectedNumSamples, if
+  // known, is used to reserve the onset envelope.
+  void prepare(double sampleRate, int64_t expectedNumSamples = 0);
+
+  // Restart a new stream with the same sample rate.
+  void reset();
+
+  // Average numChannels channels and add them to the analysis.
+  void process(const float *const *channels, int numChannels, int numSamples);
+
+  // End of stream: estimate the tempo and the beats of everything processed.
+  // The detector must be reset before processing a new stream.
+  Result finish();
+
+  // Whole sample convenience: prepare, process all channels block by block
+  // and finish. Returns the default result if shouldStop (if any) returns
+  // true before the end.
+  static Result detect(const SampleStore &store,
+                       const std::function<bool()> &shouldStop = nullptr);
+
+  static constexpr float kDefaultBpm = 120.0f;
+
+private:
+  // Spectral flux of the current frame, appended to the envelope.
+  void analyzeFrame();
+
+  // Accumulate the products of the last envelope value with the previous
+  // ones into the autocorrelation.
+  void accumulateAutocorrelation(float value);
+
+  // Beat period in envelope frames (fractional), 0 if none.
+  double estimatePeriod() const;
+
+  // Envelope frames of the beats for a period of period frames.
+  std::vector<int> trackBeats(double period) const;
+
+  static constexpr double kFrameSeconds = 0.046;
+  static constexpr int kHopDivision = 4;
+  static constexpr double kMinBpm = 60.0;
+  static constexpr double kMaxBpm = 200.0;
+  // Centre (BPM) and width (octaves) of the log-Gaussian tempo prior
+  static constexpr double kPriorBpm = 120.0;
+  static constexpr double kPriorOctaves = 1.0;
+  // Number of multiples of the period summed by the comb filter
+  static constexpr int kCombHarmonics = 4;
+  // Longest lag of the autocorrelation: kCombHarmonics beats at kMinBpm
+  static constexpr double kMaxLagSeconds = kCombHarmonics * 60.0 / kMinBpm;
+  // Weight of the tempo deviation against onset strength in beat tracking
+  static constexpr double kTightness = 100.0;
+
+  double sampleRate = 44100.0;
+  int frameSize = 0;
+  int hopSize = 0;
+  int maxLag = 0;
+
+  std::unique_ptr<juce::dsp::FFT> fft;
+  std::vector<float> window;
+  std::vector<float> frame;    // Downmixed input of the current frame
+  std::vector<float> spectrum; // FFT work buffer (2 * frameSize)
+  std::vector<float> previousLogMagnitudes;
+  int numInFrame = 0;
+  bool hasPreviousFrame = false;
+
+  // Onset envelope, one value per hop. Frame i is centred on sample
+  // i * hopSize.
+  std::vector<float> envelope;
+  // Last maxLag + 1 envelope values and the autocorrelation sums over them
+  std::vector<float> envelopeRing;
+  std::vector<double> autocorrelation;
+  double envelopeSum = 0.0;
+};
+
+// Result of TempoDetector, outside of the class so that SampleStore can cache
+// it without including this header.
+struct TempoResult {
+  float bpm = TempoDetector::kDefaultBpm;
+  // Beat times in seconds from the start of the signal. Empty if no tempo
+  // could be detected, in which case bpm is kDefaultBpm.
+  std::vector<double> beatTimes;
+};
@@ -97,8 +97,12 @@ void WaveformDisplay::paint(juce::Graphics &g) {
   }
 }
 
-void WaveformDisplay::setFile(const juce::File &file) {
-  thumbnail.setSource(new juce::FileInputSource(file));
+void WaveformDisplay::setSampleStore(const SampleStore &store) {
+  // Same hash as a FileInputSource of the file, for the thumbnail cache
+  const auto &file = store.getFile();
+  thumbnail.setReader(store.createReader().release(),
+                      file.hashCode64() ^
+                          file.getLastModificationTime().toMilliseconds());
   playheadPosition = 0.0;
   viewStart = 0.0;
   zoomLevel = 1.0;
@@ -1,4 +1,5 @@
 #pragma once
+#include "SampleStore.h"
 #include <functional>
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <juce_gui_extra/juce_gui_extra.h>
@@ -9,7 +10,8 @@ public:
                   juce::AudioThumbnailCache &cache);
 
   void paint(juce::Graphics &g) override;
-  void setFile(const juce::File &file);
+  // Show the waveform of a loaded sample, read from its store
+  void setSampleStore(const SampleStore &store);
 
   double getTotalLength() const { return thumbnail.getTotalLength(); }
 
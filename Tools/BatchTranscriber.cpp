@@ -0,0 +1,301 @@
+// Headless batch transcriber: audio files (or directories of audio files) ->
+// .mid files, without the plugin editor.
+//
+// Usage:
+//   Sample2MIDI_Batch [options] <file|directory>...
+//
+// Options:
+//   -o, --output <dir>   Write .mid files to dir (default: next to each input),
+//                        under the same subdirectories as in the input
+//                        directories
+//   -j, --jobs <n>       Number of files transcribed concurrently
+//                        (default: number of CPUs)
+//   -t, --threads <n>    Threads per file, see BasicPitch::setNumThreads
+//                        (default: 1)
+//   -r, --recursive      Search directories recursively
+//   --bpm <bpm>          Tempo written to the MIDI files (default: 120)
+
+#include "MidiBuilder.h"
+#include "PitchDetector.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  juce::Array<juce::File> inputs;
+  juce::File outputDir;
+  int numJobs = juce::SystemStats::getNumCpus();
+  int numThreadsPerFile = 1;
+  bool recursive = false;
+  float bpm = 120.0f;
+};
+
+// Audio file to transcribe and the .mid file written for it
+struct Job {
+  juce::File input;
+  juce::File output;
+};
+
+struct FileResult {
+  bool ok = false;
+  int numNotes = 0;
+  double audioSeconds = 0.0;
+  double loadSeconds = 0.0;
+  double transcribeSeconds = 0.0;
+};
+
+void printUsage() {
+  std::printf(
+      "Usage: Sample2MIDI_Batch [options] <file|directory>...\n"
+      "  -o, --output <dir>   Write .mid files to dir (default: next to "
+      "input)\n"
+      "  -j, --jobs <n>       Files transcribed concurrently (default: %d)\n"
+      "  -t, --threads <n>    Threads per file (default: 1)\n"
+      "  -r, --recursive      Search directories recursively\n"
+      "  --bpm <bpm>          Tempo written to the MIDI files (default: 120)\n",
+      juce::SystemStats::getNumCpus());
+}
+
+bool parseOptions(const juce::ArgumentList &args, Options &options) {
+  for (int i = 0; i < args.size(); ++i) {
+    const auto &arg = args[i];
+    const bool hasValue = i + 1 < args.size();
+
+    if (arg == "-h|--help") {
+      return false;
+    } else if (arg == "-o|--output" && hasValue) {
+      options.outputDir = args[++i].resolveAsFile();
+    } else if (arg == "-j|--jobs" && hasValue) {
+      options.numJobs = juce::jmax(1, args[++i].text.getIntValue());
+    } else if (arg == "-t|--threads" && hasValue) {
+      options.numThreadsPerFile = juce::jmax(1, args[++i].text.getIntValue());
+    } else if (arg == "-r|--recursive") {
+      options.recursive = true;
+    } else if (arg == "--bpm" && hasValue) {
+      options.bpm = args[++i].text.getFloatValue();
+    } else if (arg.isShortOption() || arg.isLongOption()) {
+      std::fprintf(stderr, "Unknown option: %s\n", arg.text.toRawUTF8());
+      return false;
+    } else {
+      options.inputs.add(arg.resolveAsFile());
+    }
+  }
+
+  return !options.inputs.isEmpty();
+}
+
+// .mid file written for file, found in the input directory root (root is file
+// itself for inputs given as files). Names already taken by another job get a
+// numbered suffix, e.g. for a.wav and a.flac, or a.wav given from two
+// directories.
+juce::File getOutputFile(const Options &options, const juce::File &file,
+                         const juce::File &root,
+                         std::set<juce::String> &takenPaths) {
+  juce::File output;
+  if (options.outputDir == juce::File{})
+    output = file.withFileExtension("mid");
+  else if (root.isDirectory())
+    output = options.outputDir.getChildFile(file.getRelativePathFrom(root))
+                 .withFileExtension("mid");
+  else
+    output = options.outputDir.getChildFile(file.getFileName())
+                 .withFileExtension("mid");
+
+  // Case insensitive, as are the default macOS and Windows file systems
+  const auto name = output.getFileNameWithoutExtension();
+  for (int suffix = 2;
+       !takenPaths.insert(output.getFullPathName().toLowerCase()).second;
+       ++suffix)
+    output = output.getSiblingFile(name + "_" + juce::String(suffix) + ".mid");
+
+  return output;
+}
+
+std::vector<Job> collectJobs(const Options &options,
+                             const juce::String &wildcard) {
+  std::vector<Job> jobs;
+  std::set<juce::String> takenPaths;
+
+  for (const auto &input : options.inputs) {
+    if (input.isDirectory()) {
+      auto found = input.findChildFiles(juce::File::findFiles,
+                                        options.recursive, wildcard);
+      found.sort();
+      for (const auto &file : found)
+        jobs.push_back({file, getOutputFile(options, file, input, takenPaths)});
+    } else if (input.existsAsFile()) {
+      jobs.push_back({input, getOutputFile(options, input, input, takenPaths)});
+    } else {
+      std::fprintf(stderr, "Not found: %s\n",
+                   input.getFullPathName().toRawUTF8());
+    }
+  }
+
+  return jobs;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Models and format readers owned by one worker thread, reused for all the
+// files that worker transcribes.
+class Worker {
+public:
+  explicit Worker(const Options &options) : options(options) {
+    formatManager.registerBasicFormats();
+    pitchDetector.setNumThreads(options.numThreadsPerFile);
+  }
+
+  FileResult process(const Job &job) {
+    FileResult result;
+    const auto &file = job.input;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(
+        formatManager.createReaderFor(file));
+    if (reader == nullptr || reader->lengthInSamples <= 0 ||
+        reader->lengthInSamples > std::numeric_limits<int>::max())
+      return result;
+
+    const double sampleRate = reader->sampleRate;
+    juce::AudioBuffer<float> buffer((int)reader->numChannels,
+                                    (int)reader->lengthInSamples);
+    reader->read(&buffer, 0, buffer.getNumSamples(), 0, true, true);
+    reader.reset();
+
+    result.audioSeconds = buffer.getNumSamples() / sampleRate;
+    result.loadSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+
+    auto events = pitchDetector.analyze(buffer, sampleRate);
+    auto notes = PitchDetector::toMidiNotes(events, sampleRate);
+
+    const auto &midiFile = job.output;
+    if (!midiFile.getParentDirectory().createDirectory())
+      return result;
+    midiFile.deleteFile();
+    midiBuilder.exportMidi(notes, sampleRate, midiFile, options.bpm);
+
+    result.transcribeSeconds = secondsSince(start);
+    result.numNotes = (int)notes.size();
+    result.ok = midiFile.existsAsFile();
+    return result;
+  }
+
+private:
+  const Options &options;
+  juce::AudioFormatManager formatManager;
+  PitchDetector pitchDetector;
+  MidiBuilder midiBuilder;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  juce::ArgumentList args(argc, argv);
+  Options options;
+
+  if (!parseOptions(args, options)) {
+    printUsage();
+    return 1;
+  }
+
+  if (options.outputDir != juce::File{} &&
+      !options.outputDir.createDirectory()) {
+    std::fprintf(stderr, "Cannot create output directory: %s\n",
+                 options.outputDir.getFullPathName().toRawUTF8());
+    return 1;
+  }
+
+  juce::AudioFormatManager formats;
+  formats.registerBasicFormats();
+  const auto jobs = collectJobs(options, formats.getWildcardForAllFormats());
+  const int numJobs = (int)jobs.size();
+
+  if (jobs.empty()) {
+    std::fprintf(stderr, "No audio files to transcribe\n");
+    return 1;
+  }
+
+  const int numWorkers = juce::jmin(options.numJobs, numJobs);
+
+  std::printf("Transcribing %d files with %d jobs x %d threads\n", numJobs,
+              numWorkers, options.numThreadsPerFile);
+
+  // Each worker takes the next file not yet transcribed
+  std::atomic<int> nextFile{0};
+  std::atomic<int> numDone{0};
+  std::atomic<int> numFailed{0};
+  double totalAudioSeconds = 0.0;
+  std::mutex printMutex;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  auto runWorker = [&] {
+    Worker worker(options);
+
+    for (int i = nextFile++; i < numJobs; i = nextFile++) {
+      const auto &file = jobs[(size_t)i].input;
+      FileResult result;
+
+      try {
+        result = worker.process(jobs[(size_t)i]);
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(printMutex);
+        std::fprintf(stderr, "%s: %s\n", file.getFullPathName().toRawUTF8(),
+                     e.what());
+      }
+
+      std::lock_guard<std::mutex> lock(printMutex);
+      const int done = ++numDone;
+
+      if (!result.ok) {
+        ++numFailed;
+        std::printf("[%d/%d] FAILED %s\n", done, numJobs,
+                    file.getFullPathName().toRawUTF8());
+        continue;
+      }
+
+      totalAudioSeconds += result.audioSeconds;
+      std::printf("[%d/%d] %s: %d notes, %.2f s audio, load %.3f s, "
+                  "transcribe %.3f s (%.1fx realtime)\n",
+                  done, numJobs, file.getFileName().toRawUTF8(),
+                  result.numNotes, result.audioSeconds, result.loadSeconds,
+                  result.transcribeSeconds,
+                  result.audioSeconds /
+                      juce::jmax(result.transcribeSeconds, 1e-9));
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < numWorkers; ++i)
+    threads.emplace_back(runWorker);
+
+  runWorker();
+
+  for (auto &thread : threads)
+    thread.join();
+
+  const double wallSeconds = secondsSince(start);
+
+  std::printf("Done: %d files (%d failed) in %.2f s, %.2f files/s, "
+              "%.1fx realtime\n",
+              numJobs, numFailed.load(), wallSeconds,
+              numJobs / juce::jmax(wallSeconds, 1e-9),
+              totalAudioSeconds / juce::jmax(wallSeconds, 1e-9));
+
+  return numFailed > 0 ? 1 : 0;
+}
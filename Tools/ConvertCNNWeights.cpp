@@ -0,0 +1,132 @@
+// Build-time converter of the basic pitch CNN models from RTNeural JSON to the
+// compact binary format loaded by BasicPitchCNN (see BasicPitchCNN.cpp).
+//
+// Usage:
+//   ConvertCNNWeights <output.bin> <model.json>...
+//
+// Format (native endianness, the file is generated on the build machine):
+//   char[4]  "BPCW"
+//   uint32   version (1)
+//   uint32   number of models
+//   per model:
+//     uint32 number of conv2d layers
+//     per layer:
+//       uint32  kernel size time, kernel size feature, filters in, filters out
+//       float32 weights[time][feature][in][out]
+//       float32 bias[out]
+
+#include "RTNeural/RTNeural.h" // nlohmann::json, as used by RTNeural
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace {
+
+void writeU32(std::ofstream &out, uint32_t value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void writeFloats(std::ofstream &out, const std::vector<float> &values) {
+  out.write(reinterpret_cast<const char *>(values.data()),
+            (std::streamsize)(values.size() * sizeof(float)));
+}
+
+bool convertModel(const json &model, std::ofstream &out) {
+  std::vector<const json *> convLayers;
+
+  for (const auto &layer : model.at("layers")) {
+    const auto type = layer.at("type").get<std::string>();
+
+    if (type == "conv2d") {
+      convLayers.push_back(&layer);
+    } else {
+      std::fprintf(stderr, "Unsupported layer type: %s\n", type.c_str());
+      return false;
+    }
+  }
+
+  writeU32(out, (uint32_t)convLayers.size());
+
+  for (const auto *layer : convLayers) {
+    // Same conversion as RTNeural's JSON loader: double -> float
+    const auto weights =
+        layer->at("weights")
+            .at(0)
+            .get<std::vector<std::vector<std::vector<std::vector<float>>>>>();
+    const auto bias = layer->at("weights").at(1).get<std::vector<float>>();
+
+    const auto kernelSizeTime = (uint32_t)weights.size();
+    const auto kernelSizeFeature = (uint32_t)weights.at(0).size();
+    const auto numFiltersIn = (uint32_t)weights.at(0).at(0).size();
+    const auto numFiltersOut = (uint32_t)weights.at(0).at(0).at(0).size();
+
+    if (bias.size() != numFiltersOut) {
+      std::fprintf(stderr, "Bias size does not match filters out\n");
+      return false;
+    }
+
+    writeU32(out, kernelSizeTime);
+    writeU32(out, kernelSizeFeature);
+    writeU32(out, numFiltersIn);
+    writeU32(out, numFiltersOut);
+
+    for (const auto &time : weights)
+      for (const auto &feature : time)
+        for (const auto &filterIn : feature) {
+          if (filterIn.size() != numFiltersOut) {
+            std::fprintf(stderr, "Ragged conv2d weights\n");
+            return false;
+          }
+          writeFloats(out, filterIn);
+        }
+
+    writeFloats(out, bias);
+  }
+
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::fprintf(stderr, "Usage: ConvertCNNWeights <output.bin> "
+                         "<model.json>...\n");
+    return 1;
+  }
+
+  std::ofstream out(argv[1], std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::fprintf(stderr, "Cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  out.write("BPCW", 4);
+  writeU32(out, 1);
+  writeU32(out, (uint32_t)(argc - 2));
+
+  for (int i = 2; i < argc; ++i) {
+    std::ifstream in(argv[i]);
+    if (!in) {
+      std::fprintf(stderr, "Cannot open %s\n", argv[i]);
+      return 1;
+    }
+
+    try {
+      if (!convertModel(json::parse(in), out)) {
+        std::fprintf(stderr, "Failed to convert %s\n", argv[i]);
+        return 1;
+      }
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "%s: %s\n", argv[i], e.what());
+      return 1;
+    }
+  }
+
+  return out ? 0 : 1;
+}
@@ -0,0 +1,688 @@
+// Golden output regression checker: transcribes reference clips with the
+// pipeline of the plugin (SampleStore, downmix, resampling, features, CNN,
+// notes) and compares the posteriorgrams and note events with golden files
+// stored next to the clips (<clip>.golden), written beforehand with --update.
+//
+// Usage:
+//   Sample2MIDI_Golden [options] <clip|directory>...
+//   Sample2MIDI_Golden --generate <directory>
+//
+// Options:
+//   --update                   Write the golden files instead of checking
+//   --golden-dir <dir>         Read and write the golden files in dir instead
+//                              of next to the clips
+//   --pg-tolerance <x>         Max absolute posteriorgram error (default 1e-4)
+//   --frame-tolerance <n>      Max shift of note boundaries in frames
+//                              (default 0)
+//   --amplitude-tolerance <x>  Max note amplitude error (default 1e-4)
+//   -t, --threads <n>          Threads per clip, see BasicPitch::setNumThreads
+//                              (default: 1)
+//   --stream                   Transcribe while decoding, as the plugin does
+//                              for compressed files
+//   --compare-full             Compare with a transcription computing the
+//                              features in a single call on the whole clip
+//                              instead of with golden files
+//   -r, --recursive            Search directories recursively
+//   --generate <dir>           Write the synthetic reference clips to dir
+//
+// The features model normalizes each call on its own, so the features
+// computed per shard drift from a single call on the whole clip: with
+// --compare-full, the tolerances bound that drift.
+//
+// The synthetic clips are rendered deterministically, so that CTest checks
+// them against the golden files of Tools/golden without storing audio in the
+// repository (see CMakeLists.txt).
+//
+// Exits with 1 if a clip has no golden file or does not match it. Golden
+// files are written in the byte order of the machine (little endian on all
+// supported platforms).
+
+#include "PitchDetector.h"
+#include "SampleStore.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  juce::Array<juce::File> inputs;
+  bool update = false;
+  float pgTolerance = 1e-4f;
+  int frameTolerance = 0;
+  double amplitudeTolerance = 1e-4;
+  int numThreads = 1;
+  bool stream = false;
+  bool compareFull = false;
+  bool recursive = false;
+  juce::File goldenDir;
+  juce::File generateDir;
+};
+
+// Posteriorgrams and notes of a transcription
+struct Transcription {
+  Posteriorgram contours;
+  Posteriorgram notes;
+  Posteriorgram onsets;
+  std::vector<Notes::Event> events;
+  double audioSeconds = 0.0;
+  double transcribeSeconds = 0.0;
+};
+
+// Differences between a transcription and its golden file
+struct Comparison {
+  float contoursError = 0.0f;
+  float notesError = 0.0f;
+  float onsetsError = 0.0f;
+  bool sameNumFrames = true;
+  bool exactEvents = false;
+  int numMatched = 0;
+  int numMissing = 0; // Golden events without a match
+  int numExtra = 0;   // Transcribed events without a match
+};
+
+constexpr int kGoldenMagic = 0x474d3253; // "S2MG"
+constexpr int kGoldenVersion = 1;
+// Times, frames, pitch, amplitude and number of bends of an event
+constexpr juce::int64 kEventNumBytes = 3 * 8 + 4 * 4;
+
+void printUsage() {
+  std::printf(
+      "Usage: Sample2MIDI_Golden [options] <clip|directory>...\n"
+      "  --update                   Write the golden files instead of "
+      "checking\n"
+      "  --pg-tolerance <x>         Max absolute posteriorgram error "
+      "(default 1e-4)\n"
+      "  --frame-tolerance <n>      Max shift of note boundaries in frames "
+      "(default 0)\n"
+      "  --amplitude-tolerance <x>  Max note amplitude error (default 1e-4)\n"
+      "  -t, --threads <n>          Threads per clip (default: 1)\n"
+      "  --stream                   Transcribe while decoding\n"
+      "  --compare-full             Compare with a single features call on "
+      "the whole clip\n"
+      "  -r, --recursive            Search directories recursively\n"
+      "  --golden-dir <dir>         Golden files in dir instead of next to "
+      "the clips\n"
+      "  --generate <dir>           Write the synthetic reference clips to "
+      "dir\n");
+}
+
+bool parseOptions(const juce::ArgumentList &args, Options &options) {
+  for (int i = 0; i < args.size(); ++i) {
+    const auto &arg = args[i];
+    const bool hasValue = i + 1 < args.size();
+
+    if (arg == "-h|--help") {
+      return false;
+    } else if (arg == "--update") {
+      options.update = true;
+    } else if (arg == "--pg-tolerance" && hasValue) {
+      options.pgTolerance = args[++i].text.getFloatValue();
+    } else if (arg == "--frame-tolerance" && hasValue) {
+      options.frameTolerance = juce::jmax(0, args[++i].text.getIntValue());
+    } else if (arg == "--amplitude-tolerance" && hasValue) {
+      options.amplitudeTolerance = args[++i].text.getDoubleValue();
+    } else if (arg == "-t|--threads" && hasValue) {
+      options.numThreads = juce::jmax(1, args[++i].text.getIntValue());
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--compare-full") {
+      options.compareFull = true;
+    } else if (arg == "-r|--recursive") {
+      options.recursive = true;
+    } else if (arg == "--golden-dir" && hasValue) {
+      options.goldenDir = args[++i].resolveAsFile();
+    } else if (arg == "--generate" && hasValue) {
+      options.generateDir = args[++i].resolveAsFile();
+    } else if (arg.isShortOption() || arg.isLongOption()) {
+      std::fprintf(stderr, "Unknown option: %s\n", arg.text.toRawUTF8());
+      return false;
+    } else {
+      options.inputs.add(arg.resolveAsFile());
+    }
+  }
+
+  return !options.inputs.isEmpty() || options.generateDir != juce::File();
+}
+
+juce::Array<juce::File> collectClips(const Options &options,
+                                     const juce::String &wildcard) {
+  juce::Array<juce::File> clips;
+
+  for (const auto &input : options.inputs) {
+    if (input.isDirectory()) {
+      auto found = input.findChildFiles(juce::File::findFiles,
+                                        options.recursive, wildcard);
+      found.sort();
+      clips.addArray(found);
+    } else if (input.existsAsFile()) {
+      clips.add(input);
+    } else {
+      std::fprintf(stderr, "Not found: %s\n",
+                   input.getFullPathName().toRawUTF8());
+    }
+  }
+
+  return clips;
+}
+
+juce::File getGoldenFile(const juce::File &clip, const Options &options) {
+  const auto name = clip.getFileName() + ".golden";
+  if (options.goldenDir == juce::File())
+    return clip.getSiblingFile(name);
+  return options.goldenDir.getChildFile(name);
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic clips
+// ---------------------------------------------------------------------------
+
+// Reference clip rendered by --generate. The formats cover both ways the
+// plugin loads samples: WAV is memory mapped, FLAC is decoded.
+struct SyntheticClip {
+  const char *name;
+  double sampleRate;
+  int numChannels;
+  double seconds;
+  void (*render)(juce::AudioBuffer<float> &, double);
+};
+
+// Add a note with two overtones, a 10 ms attack and a 50 ms release, from
+// start to end seconds. vibratoCents modulates the pitch at 5 Hz so that the
+// note has pitch bends.
+void addNote(float *samples, int numSamples, double sampleRate, int pitch,
+             double start, double end, float gain, double vibratoCents = 0.0) {
+  constexpr double kAttackSeconds = 0.01;
+  constexpr double kReleaseSeconds = 0.05;
+  const double twoPi = juce::MathConstants<double>::twoPi;
+
+  const int first = juce::jlimit(0, numSamples, (int)(start * sampleRate));
+  const int last = juce::jlimit(
+      0, numSamples, (int)((end + kReleaseSeconds) * sampleRate));
+  double phase = 0.0;
+
+  for (int i = first; i < last; ++i) {
+    const double t = i / sampleRate;
+    const double envelope =
+        juce::jlimit(0.0, 1.0,
+                     std::min((t - start) / kAttackSeconds,
+                              1.0 - (t - end) / kReleaseSeconds));
+    const double cents = vibratoCents * std::sin(twoPi * 5.0 * (t - start));
+
+    samples[i] += gain * (float)(envelope * (std::sin(phase) +
+                                             0.5 * std::sin(2.0 * phase) +
+                                             0.25 * std::sin(3.0 * phase)));
+    phase += twoPi * juce::MidiMessage::getMidiNoteInHertz(pitch) *
+             std::pow(2.0, cents / 1200.0) / sampleRate;
+  }
+}
+
+// C major triad, each note panned differently
+void renderChord(juce::AudioBuffer<float> &buffer, double sampleRate) {
+  static const int pitches[3] = {60, 64, 67};
+
+  for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+    for (int n = 0; n < 3; ++n)
+      addNote(buffer.getWritePointer(ch), buffer.getNumSamples(), sampleRate,
+              pitches[n], 0.25, 1.75, ch == n % 2 ? 0.15f : 0.08f);
+}
+
+// Rising phrase ending on a held note with vibrato
+void renderMelody(juce::AudioBuffer<float> &buffer, double sampleRate) {
+  static const int pitches[5] = {57, 59, 60, 62, 64};
+  float *samples = buffer.getWritePointer(0);
+
+  for (int n = 0; n < 4; ++n)
+    addNote(samples, buffer.getNumSamples(), sampleRate, pitches[n],
+            0.1 + 0.3 * n, 0.35 + 0.3 * n, 0.25f);
+  addNote(samples, buffer.getNumSamples(), sampleRate, pitches[4], 1.3, 2.3,
+          0.25f, 40.0);
+}
+
+// Low and high notes over white noise of a fixed seed
+void renderNoisyNotes(juce::AudioBuffer<float> &buffer, double sampleRate) {
+  float *samples = buffer.getWritePointer(0);
+  juce::Random random(0x5332);
+
+  for (int i = 0; i < buffer.getNumSamples(); ++i)
+    samples[i] = 0.02f * (random.nextFloat() - 0.5f);
+
+  addNote(samples, buffer.getNumSamples(), sampleRate, 40, 0.2, 0.9, 0.3f);
+  addNote(samples, buffer.getNumSamples(), sampleRate, 81, 1.0, 1.6, 0.15f);
+}
+
+// Chord progression under a melody, one chord every 2 s. Long enough to span
+// three shards of BasicPitch (2048 frames, ~23.8 s): the shard seams fall
+// inside held chords, so the stitching and the CNN warm-up are compared.
+void renderProgression(juce::AudioBuffer<float> &buffer, double sampleRate) {
+  static const int chords[4][3] = {
+      {60, 64, 67}, {57, 60, 64}, {53, 57, 60}, {55, 59, 62}};
+  static const int melody[8] = {72, 74, 76, 79, 77, 76, 74, 71};
+  float *samples = buffer.getWritePointer(0);
+  const int numSamples = buffer.getNumSamples();
+
+  for (int n = 0; 2.0 * n < numSamples / sampleRate; ++n) {
+    const double start = 2.0 * n;
+
+    for (int pitch : chords[n % 4])
+      addNote(samples, numSamples, sampleRate, pitch, start, start + 1.9,
+              0.08f);
+    addNote(samples, numSamples, sampleRate, melody[n % 8], start + 0.5,
+            start + 1.5, 0.12f, n % 3 == 0 ? 30.0 : 0.0);
+  }
+}
+
+// 16 bit, so that the clips and the golden files do not depend on how the
+// samples were rounded. The 22.05 kHz clip skips the resampling.
+const SyntheticClip kSyntheticClips[] = {
+    {"chord_44100_stereo.wav", 44100.0, 2, 2.0, renderChord},
+    {"melody_48000_mono.flac", 48000.0, 1, 2.5, renderMelody},
+    {"noisy_notes_22050_mono.wav", 22050.0, 1, 1.8, renderNoisyNotes},
+    {"progression_44100_mono.flac", 44100.0, 1, 60.0, renderProgression},
+};
+
+bool writeClip(const juce::File &file, const juce::AudioBuffer<float> &buffer,
+               double sampleRate, juce::AudioFormatManager &formatManager) {
+  auto *format = formatManager.findFormatForFileExtension(
+      file.getFileExtension());
+  if (format == nullptr)
+    return false;
+
+  file.deleteFile();
+  std::unique_ptr<juce::OutputStream> out(file.createOutputStream());
+  if (out == nullptr)
+    return false;
+
+  std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(
+      out.get(), sampleRate, (unsigned int)buffer.getNumChannels(), 16, {},
+      0));
+  if (writer == nullptr)
+    return false;
+
+  // Owned by the writer from now on
+  out.release();
+  return writer->writeFromAudioSampleBuffer(buffer, 0,
+                                            buffer.getNumSamples());
+}
+
+bool generateClips(const juce::File &directory,
+                   juce::AudioFormatManager &formatManager) {
+  if (!directory.createDirectory())
+    return false;
+
+  bool ok = true;
+
+  for (const auto &clip : kSyntheticClips) {
+    const auto file = directory.getChildFile(clip.name);
+    juce::AudioBuffer<float> buffer(
+        clip.numChannels, (int)(clip.seconds * clip.sampleRate));
+    buffer.clear();
+    clip.render(buffer, clip.sampleRate);
+
+    const bool written =
+        writeClip(file, buffer, clip.sampleRate, formatManager);
+    ok = ok && written;
+    std::printf("%s: %s\n", clip.name, written ? "written" : "FAILED");
+  }
+
+  return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Transcription
+// ---------------------------------------------------------------------------
+
+bool transcribe(const juce::File &clip, const Options &options,
+                juce::AudioFormatManager &formatManager,
+                PitchDetector &pitchDetector, Transcription &result) {
+  auto store = SampleStore::open(clip, formatManager);
+  if (store == nullptr)
+    return false;
+
+  std::vector<Notes::Event> events;
+
+  if (options.stream) {
+    // Decoded on another thread while it is transcribed, the time including
+    // the decoding
+    const auto start = std::chrono::steady_clock::now();
+    std::thread decoder([store] { store->decode(nullptr); });
+    events = pitchDetector.analyze(*store);
+    decoder.join();
+    result.transcribeSeconds = secondsSince(start);
+  } else {
+    // Memory mapped as the plugin loads it, or decoded beforehand
+    store->decode(nullptr);
+    if (store->getNumSamples() <= 0)
+      return false;
+
+    const auto start = std::chrono::steady_clock::now();
+    events = pitchDetector.analyze(*store);
+    result.transcribeSeconds = secondsSince(start);
+  }
+
+  result.audioSeconds = store->getNumSamples() / store->getSampleRate();
+
+  const auto &basicPitch = pitchDetector.getBasicPitch();
+  result.contours = basicPitch.getContoursPG();
+  result.notes = basicPitch.getNotesPG();
+  result.onsets = basicPitch.getOnsetsPG();
+  result.events = std::move(events);
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Golden files
+// ---------------------------------------------------------------------------
+
+void writePosteriorgram(juce::OutputStream &out, const Posteriorgram &pg) {
+  out.writeInt64((juce::int64)pg.getNumFrames());
+  out.writeInt((int)pg.getNumBins());
+  out.write(pg.data(), pg.getNumFrames() * pg.getNumBins() * sizeof(float));
+}
+
+bool readPosteriorgram(juce::InputStream &in, Posteriorgram &pg) {
+  const auto numFrames = in.readInt64();
+  const int numBins = in.readInt();
+  if (numFrames < 0 || numBins <= 0 || numBins > NUM_FREQ_IN ||
+      numFrames * numBins * (juce::int64)sizeof(float) >
+          in.getNumBytesRemaining())
+    return false;
+
+  pg.resize((size_t)numFrames, (size_t)numBins);
+  const size_t numBytes = (size_t)numFrames * (size_t)numBins * sizeof(float);
+  return in.read(pg.data(), (int)numBytes) == (int)numBytes;
+}
+
+bool writeGolden(const juce::File &file, const Transcription &transcription) {
+  file.deleteFile();
+  juce::FileOutputStream out(file);
+  if (!out.openedOk())
+    return false;
+
+  out.writeInt(kGoldenMagic);
+  out.writeInt(kGoldenVersion);
+
+  writePosteriorgram(out, transcription.contours);
+  writePosteriorgram(out, transcription.notes);
+  writePosteriorgram(out, transcription.onsets);
+
+  out.writeInt64((juce::int64)transcription.events.size());
+  for (const auto &event : transcription.events) {
+    out.writeDouble(event.startTime);
+    out.writeDouble(event.endTime);
+    out.writeInt(event.startFrame);
+    out.writeInt(event.endFrame);
+    out.writeInt(event.pitch);
+    out.writeDouble(event.amplitude);
+    out.writeInt((int)event.bends.size());
+    for (int bend : event.bends)
+      out.writeInt(bend);
+  }
+
+  out.flush();
+  return out.getStatus().wasOk();
+}
+
+bool readGolden(const juce::File &file, Transcription &golden) {
+  juce::FileInputStream in(file);
+  if (!in.openedOk() || in.readInt() != kGoldenMagic ||
+      in.readInt() != kGoldenVersion)
+    return false;
+
+  if (!readPosteriorgram(in, golden.contours) ||
+      !readPosteriorgram(in, golden.notes) ||
+      !readPosteriorgram(in, golden.onsets))
+    return false;
+
+  // Counts are checked against the size of the file before allocating
+  const auto numEvents = in.readInt64();
+  if (numEvents < 0 || numEvents > in.getNumBytesRemaining())
+    return false;
+
+  golden.events.resize((size_t)numEvents);
+  for (auto &event : golden.events) {
+    if (in.getNumBytesRemaining() < kEventNumBytes)
+      return false;
+
+    event.startTime = in.readDouble();
+    event.endTime = in.readDouble();
+    event.startFrame = in.readInt();
+    event.endFrame = in.readInt();
+    event.pitch = in.readInt();
+    event.amplitude = in.readDouble();
+    const int numBends = in.readInt();
+    if (numBends < 0 ||
+        numBends * (juce::int64)sizeof(int) > in.getNumBytesRemaining())
+      return false;
+
+    event.bends.resize((size_t)numBends);
+    for (int &bend : event.bends)
+      bend = in.readInt();
+  }
+
+  // Nothing left: the file is neither truncated nor longer than expected
+  return in.getPosition() == in.getTotalLength();
+}
+
+// ---------------------------------------------------------------------------
+// Comparison
+// ---------------------------------------------------------------------------
+
+float maxAbsError(const Posteriorgram &a, const Posteriorgram &b) {
+  const size_t size = a.getNumFrames() * a.getNumBins();
+  float error = 0.0f;
+  for (size_t i = 0; i < size; ++i)
+    error = std::max(error, std::abs(a.data()[i] - b.data()[i]));
+  return error;
+}
+
+bool sameShape(const Posteriorgram &a, const Posteriorgram &b) {
+  return a.getNumFrames() == b.getNumFrames() &&
+         a.getNumBins() == b.getNumBins();
+}
+
+// Each golden event is matched with the first unmatched transcribed event of
+// the same pitch whose boundaries and amplitude are within the tolerances
+void matchEvents(const std::vector<Notes::Event> &golden,
+                 const std::vector<Notes::Event> &events,
+                 const Options &options, Comparison &comparison) {
+  std::vector<bool> matched(events.size(), false);
+
+  for (const auto &expected : golden) {
+    bool found = false;
+
+    for (size_t i = 0; i < events.size() && !found; ++i) {
+      const auto &event = events[i];
+      found = !matched[i] && event.pitch == expected.pitch &&
+              std::abs(event.startFrame - expected.startFrame) <=
+                  options.frameTolerance &&
+              std::abs(event.endFrame - expected.endFrame) <=
+                  options.frameTolerance &&
+              std::abs(event.amplitude - expected.amplitude) <=
+                  options.amplitudeTolerance;
+      if (found)
+        matched[i] = true;
+    }
+
+    if (found)
+      ++comparison.numMatched;
+    else
+      ++comparison.numMissing;
+  }
+
+  comparison.numExtra = (int)std::count(matched.begin(), matched.end(), false);
+}
+
+Comparison compare(const Transcription &golden,
+                   const Transcription &transcription,
+                   const Options &options) {
+  Comparison comparison;
+
+  comparison.sameNumFrames =
+      sameShape(golden.contours, transcription.contours) &&
+      sameShape(golden.notes, transcription.notes) &&
+      sameShape(golden.onsets, transcription.onsets);
+
+  if (comparison.sameNumFrames) {
+    comparison.contoursError =
+        maxAbsError(golden.contours, transcription.contours);
+    comparison.notesError = maxAbsError(golden.notes, transcription.notes);
+    comparison.onsetsError = maxAbsError(golden.onsets, transcription.onsets);
+  }
+
+  comparison.exactEvents = golden.events == transcription.events;
+  if (comparison.exactEvents)
+    comparison.numMatched = (int)golden.events.size();
+  else
+    matchEvents(golden.events, transcription.events, options, comparison);
+
+  return comparison;
+}
+
+bool passes(const Comparison &comparison, const Options &options) {
+  return comparison.sameNumFrames &&
+         comparison.contoursError <= options.pgTolerance &&
+         comparison.notesError <= options.pgTolerance &&
+         comparison.onsetsError <= options.pgTolerance &&
+         comparison.numMissing == 0 && comparison.numExtra == 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  juce::ArgumentList args(argc, argv);
+  Options options;
+
+  if (!parseOptions(args, options)) {
+    printUsage();
+    return 1;
+  }
+
+  juce::AudioFormatManager formatManager;
+  formatManager.registerBasicFormats();
+
+  if (options.generateDir != juce::File())
+    return generateClips(options.generateDir, formatManager) ? 0 : 1;
+
+  const auto clips =
+      collectClips(options, formatManager.getWildcardForAllFormats());
+
+  if (clips.isEmpty()) {
+    std::fprintf(stderr, "No clips\n");
+    return 1;
+  }
+
+  if (options.update && options.compareFull) {
+    std::fprintf(stderr, "--update and --compare-full are exclusive\n");
+    return 1;
+  }
+
+  PitchDetector pitchDetector;
+  pitchDetector.setNumThreads(options.numThreads);
+
+  // Reference of --compare-full, transcribed from the decoded clip
+  PitchDetector reference;
+  reference.setSingleFeaturesCall(true);
+  auto referenceOptions = options;
+  referenceOptions.stream = false;
+
+  int numFailed = 0;
+  double totalAudioSeconds = 0.0;
+  double totalTranscribeSeconds = 0.0;
+  float maxPGError = 0.0f;
+
+  for (const auto &clip : clips) {
+    const auto name = clip.getFileName();
+    Transcription transcription;
+
+    if (!transcribe(clip, options, formatManager, pitchDetector,
+                    transcription)) {
+      ++numFailed;
+      std::printf("%s: FAILED to read\n", name.toRawUTF8());
+      continue;
+    }
+
+    totalAudioSeconds += transcription.audioSeconds;
+    totalTranscribeSeconds += transcription.transcribeSeconds;
+
+    const double framesPerSecond =
+        transcription.notes.getNumFrames() /
+        juce::jmax(transcription.transcribeSeconds, 1e-9);
+    const double realtime = transcription.audioSeconds /
+                            juce::jmax(transcription.transcribeSeconds, 1e-9);
+
+    const auto goldenFile = getGoldenFile(clip, options);
+
+    if (options.update) {
+      if (!goldenFile.getParentDirectory().createDirectory() ||
+          !writeGolden(goldenFile, transcription)) {
+        ++numFailed;
+        std::printf("%s: FAILED to write %s\n", name.toRawUTF8(),
+                    goldenFile.getFullPathName().toRawUTF8());
+        continue;
+      }
+
+      std::printf("%s: updated, %d notes, %.0f frames/s (%.1fx realtime)\n",
+                  name.toRawUTF8(), (int)transcription.events.size(),
+                  framesPerSecond, realtime);
+      continue;
+    }
+
+    Transcription expected;
+    if (options.compareFull) {
+      if (!transcribe(clip, referenceOptions, formatManager, reference,
+                      expected)) {
+        ++numFailed;
+        std::printf("%s: FAILED to read\n", name.toRawUTF8());
+        continue;
+      }
+    } else if (!readGolden(goldenFile, expected)) {
+      ++numFailed;
+      std::printf("%s: FAILED, no valid golden file (run with --update)\n",
+                  name.toRawUTF8());
+      continue;
+    }
+
+    const auto comparison = compare(expected, transcription, options);
+    const bool ok = passes(comparison, options);
+    if (!ok)
+      ++numFailed;
+
+    maxPGError = std::max({maxPGError, comparison.contoursError,
+                           comparison.notesError, comparison.onsetsError});
+
+    if (!comparison.sameNumFrames)
+      std::printf("%s: FAILED, %d frames instead of %d\n", name.toRawUTF8(),
+                  (int)transcription.notes.getNumFrames(),
+                  (int)expected.notes.getNumFrames());
+    else
+      std::printf("%s: %s, max abs error contours %.3g notes %.3g onsets "
+                  "%.3g, notes %s %d/%d (%d missing, %d extra), "
+                  "%.0f frames/s (%.1fx realtime)\n",
+                  name.toRawUTF8(), ok ? "OK" : "FAILED",
+                  comparison.contoursError, comparison.notesError,
+                  comparison.onsetsError,
+                  comparison.exactEvents ? "exact" : "matched",
+                  comparison.numMatched, (int)expected.events.size(),
+                  comparison.numMissing, comparison.numExtra, framesPerSecond,
+                  realtime);
+  }
+
+  std::printf("%s %d clips (%d failed), max abs posteriorgram error %.3g, "
+              "%.1fx realtime\n",
+              options.update ? "Updated" : "Checked", clips.size(), numFailed,
+              maxPGError,
+              totalAudioSeconds / juce::jmax(totalTranscribeSeconds, 1e-9));
+
+  return numFailed == 0 ? 0 : 1;
+}
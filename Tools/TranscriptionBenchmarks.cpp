@@ -0,0 +1,372 @@
+// Microbenchmarks of the transcription pipeline stages (Google Benchmark).
+//
+// Inputs are deterministic synthetic signals and posteriorgrams of several
+// lengths (argument: seconds of audio), so results can be compared across
+// releases. Each benchmark reports frames_per_second and ns_per_frame, frames
+// being model frames (FFT_HOP samples at 22050 Hz) of the input.
+//
+// Usage:
+//   Sample2MIDI_bench [--benchmark_filter=<regex>] [--benchmark_out=<file>]
+//
+// Results are written as JSON to Sample2MIDI_bench.json unless --benchmark_out
+// is given.
+
+#include "BasicPitchCNN.h"
+#include "Features.h"
+#include "MidiBuilder.h"
+#include "Notes.h"
+#include "PitchDetector.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <string>
+#include <vector>
+
+// Access to the private stages benchmarked on their own
+struct BenchmarkAccess {
+  static std::vector<float> prepareAudio(PitchDetector &detector,
+                                         const juce::AudioBuffer<float> &buffer,
+                                         double sampleRate) {
+    return detector.prepareAudio(buffer, sampleRate);
+  }
+
+  static void inferredOnsets(const Posteriorgram &onsets,
+                             const Posteriorgram &notes,
+                             Posteriorgram &inferred) {
+    Notes::_inferredOnsets(onsets, notes, inferred);
+  }
+
+  static void addPitchBends(std::vector<Notes::Event> &events,
+                            const Posteriorgram &contours) {
+    Notes::_addPitchBends(events, contours);
+  }
+};
+
+namespace {
+
+constexpr double kSourceSampleRate = 44100.0;
+
+// Lengths of the inputs, in seconds of audio
+void inputLengths(benchmark::internal::Benchmark *benchmark) {
+  benchmark->Arg(5)->Arg(30)->Arg(120)->Unit(benchmark::kMillisecond);
+}
+
+// Linear congruential generator: same sequence on every platform and standard
+// library, unlike the <random> distributions
+class Lcg {
+public:
+  explicit Lcg(uint32_t seed) : state(seed) {}
+
+  // Uniform in [0, 1)
+  float next() {
+    state = state * 1664525u + 1013904223u;
+    return (float)(state >> 8) / (float)(1u << 24);
+  }
+
+  int nextInt(int begin, int end) {
+    return begin + (int)(next() * (float)(end - begin));
+  }
+
+private:
+  uint32_t state;
+};
+
+int64_t numModelFrames(int64_t seconds) {
+  return seconds * AUDIO_SAMPLE_RATE / FFT_HOP + 1;
+}
+
+void setFrameCounters(benchmark::State &state, int64_t numFrames) {
+  state.counters["frames_per_second"] = benchmark::Counter(
+      (double)numFrames, benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["ns_per_frame"] = benchmark::Counter(
+      (double)numFrames * 1e-9, benchmark::Counter::kIsIterationInvariantRate |
+                                    benchmark::Counter::kInvert);
+}
+
+// Bass line and a three note chord changing every half second, with a little
+// noise. Channels differ slightly so the mono mix is not a copy.
+juce::AudioBuffer<float> makeSignal(int64_t seconds, double sampleRate,
+                                    int numChannels) {
+  const int numSamples = (int)(seconds * sampleRate);
+  const int samplesPerChord = (int)(0.5 * sampleRate);
+  static const int chords[4][3] = {
+      {60, 64, 67}, {57, 60, 64}, {53, 57, 60}, {55, 59, 62}};
+
+  juce::AudioBuffer<float> buffer(numChannels, numSamples);
+  Lcg lcg(1);
+
+  for (int ch = 0; ch < numChannels; ++ch) {
+    float *samples = buffer.getWritePointer(ch);
+    const float gain = 1.0f - 0.1f * (float)ch;
+
+    for (int i = 0; i < numSamples; ++i) {
+      const auto &chord = chords[(i / samplesPerChord) % 4];
+      const double t = i / sampleRate;
+      double value = 0.3 * std::sin(juce::MathConstants<double>::twoPi *
+                                    juce::MidiMessage::getMidiNoteInHertz(
+                                        chord[0] - 24) *
+                                    t);
+      for (int note : chord)
+        value += 0.15 * std::sin(juce::MathConstants<double>::twoPi *
+                                 juce::MidiMessage::getMidiNoteInHertz(note) *
+                                 t);
+      samples[i] = gain * (float)value + 0.01f * (lcg.next() - 0.5f);
+    }
+  }
+
+  return buffer;
+}
+
+std::vector<float> makeModelSignal(int64_t seconds) {
+  const auto buffer = makeSignal(seconds, AUDIO_SAMPLE_RATE, 1);
+  return std::vector<float>(buffer.getReadPointer(0),
+                            buffer.getReadPointer(0) + buffer.getNumSamples());
+}
+
+struct Posteriorgrams {
+  Posteriorgram notes;
+  Posteriorgram onsets;
+  Posteriorgram contours;
+};
+
+// Low level noise with notes of random pitch and length starting every 20
+// frames: note activations with a decay, onset peaks on their first frames
+// and contours around their pitch with a slow vibrato.
+Posteriorgrams makePosteriorgrams(int64_t numFrames) {
+  Posteriorgrams pgs;
+  pgs.notes.resize((size_t)numFrames, NUM_FREQ_OUT);
+  pgs.onsets.resize((size_t)numFrames, NUM_FREQ_OUT);
+  pgs.contours.resize((size_t)numFrames, NUM_FREQ_OUT * 3);
+
+  Lcg lcg(2);
+
+  for (size_t i = 0; i < (size_t)numFrames; ++i) {
+    for (int j = 0; j < NUM_FREQ_OUT; ++j) {
+      pgs.notes[i][j] = 0.05f * lcg.next();
+      pgs.onsets[i][j] = 0.05f * lcg.next();
+    }
+    for (int j = 0; j < NUM_FREQ_OUT * 3; ++j)
+      pgs.contours[i][j] = 0.05f * lcg.next();
+  }
+
+  for (int64_t start = 0; start < numFrames; start += 20) {
+    const int numNotes = lcg.nextInt(1, 4);
+
+    for (int n = 0; n < numNotes; ++n) {
+      const int pitch = lcg.nextInt(20, 70);
+      const int64_t end = std::min<int64_t>(start + lcg.nextInt(10, 80),
+                                            numFrames);
+
+      pgs.onsets[(size_t)start][pitch] = 0.9f;
+      if (start + 1 < end)
+        pgs.onsets[(size_t)start + 1][pitch] = 0.4f;
+
+      for (int64_t i = start; i < end; ++i) {
+        const float decay = std::exp(-0.01f * (float)(i - start));
+        pgs.notes[(size_t)i][pitch] = 0.8f * decay + 0.1f;
+
+        const int centre =
+            3 * pitch + 1 + (int)std::lround(std::sin(0.2 * (double)i));
+        pgs.contours[(size_t)i][centre] = 0.8f * decay + 0.1f;
+        if (centre > 0)
+          pgs.contours[(size_t)i][centre - 1] = 0.4f * decay;
+        if (centre + 1 < NUM_FREQ_OUT * 3)
+          pgs.contours[(size_t)i][centre + 1] = 0.4f * decay;
+      }
+    }
+  }
+
+  return pgs;
+}
+
+std::vector<Notes::Event> makeEvents(const Posteriorgrams &pgs) {
+  Notes notes;
+  return notes.convert(pgs.notes, pgs.onsets, pgs.contours,
+                       Notes::ConvertParams{}, true);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+void BM_PrepareAudio(benchmark::State &state) {
+  const auto buffer = makeSignal(state.range(0), kSourceSampleRate, 2);
+  PitchDetector detector;
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        BenchmarkAccess::prepareAudio(detector, buffer, kSourceSampleRate));
+
+  setFrameCounters(state, numModelFrames(state.range(0)));
+}
+
+void BM_ComputeFeatures(benchmark::State &state) {
+  const auto audio = makeModelSignal(state.range(0));
+  Features features(PitchDetector::getFeaturesSessionParams());
+  size_t numFrames = 0;
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        features.computeFeatures(audio.data(), audio.size(), numFrames));
+
+  setFrameCounters(state, (int64_t)numFrames);
+}
+
+void BM_CNNFrameInference(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const size_t frameSize = NUM_HARMONICS * NUM_FREQ_IN;
+
+  // Features are normalized in [0, 1]
+  std::vector<float> frames((size_t)numFrames * frameSize);
+  Lcg lcg(3);
+  for (auto &value : frames)
+    value = lcg.next();
+
+  BasicPitchCNN cnn;
+  std::vector<float> contours(NUM_FREQ_OUT * 3);
+  std::vector<float> notes(NUM_FREQ_OUT);
+  std::vector<float> onsets(NUM_FREQ_OUT);
+
+  for (auto _ : state) {
+    cnn.reset();
+    for (int64_t i = 0; i < numFrames; ++i)
+      cnn.frameInference(frames.data() + (size_t)i * frameSize, contours,
+                         notes, onsets);
+    benchmark::DoNotOptimize(onsets.data());
+  }
+
+  setFrameCounters(state, numFrames);
+}
+
+void BM_NotesConvertNewAudio(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto pgs = makePosteriorgrams(numFrames);
+  Notes::ConvertParams params;
+  params.pitchBend = MultiPitchBend;
+  Notes notes;
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        notes.convert(pgs.notes, pgs.onsets, pgs.contours, params, true));
+
+  setFrameCounters(state, numFrames);
+}
+
+// Parameter change on the same audio: the parameter independent passes are
+// reused. Alternates between two frame thresholds so that no result is cached.
+void BM_NotesConvertUpdate(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto pgs = makePosteriorgrams(numFrames);
+  Notes::ConvertParams params;
+  params.pitchBend = MultiPitchBend;
+  Notes notes;
+  notes.convert(pgs.notes, pgs.onsets, pgs.contours, params, true);
+
+  bool flip = false;
+  for (auto _ : state) {
+    params.frameThreshold = flip ? 0.5f : 0.6f;
+    flip = !flip;
+    benchmark::DoNotOptimize(
+        notes.convert(pgs.notes, pgs.onsets, pgs.contours, params, false));
+  }
+
+  setFrameCounters(state, numFrames);
+}
+
+void BM_InferredOnsets(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto pgs = makePosteriorgrams(numFrames);
+  Posteriorgram inferred;
+
+  for (auto _ : state) {
+    BenchmarkAccess::inferredOnsets(pgs.onsets, pgs.notes, inferred);
+    benchmark::DoNotOptimize(inferred.data());
+  }
+
+  setFrameCounters(state, numFrames);
+}
+
+void BM_AddPitchBends(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto pgs = makePosteriorgrams(numFrames);
+  auto events = makeEvents(pgs);
+
+  for (auto _ : state) {
+    // Bends are appended: start from none, keeping their memory
+    for (auto &event : events)
+      event.bends.clear();
+    BenchmarkAccess::addPitchBends(events, pgs.contours);
+    benchmark::DoNotOptimize(events.data());
+  }
+
+  setFrameCounters(state, numFrames);
+}
+
+void BM_QuantizeToChords(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto notes = PitchDetector::toMidiNotes(
+      makeEvents(makePosteriorgrams(numFrames)), kSourceSampleRate);
+  MidiBuilder builder;
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        builder.quantizeToChords(notes, kSourceSampleRate));
+
+  setFrameCounters(state, numFrames);
+}
+
+void BM_ExportMidi(benchmark::State &state) {
+  const int64_t numFrames = numModelFrames(state.range(0));
+  const auto notes = PitchDetector::toMidiNotes(
+      makeEvents(makePosteriorgrams(numFrames)), kSourceSampleRate);
+  MidiBuilder builder;
+  juce::TemporaryFile file(".mid");
+
+  for (auto _ : state) {
+    // exportMidi appends to existing files
+    file.getFile().deleteFile();
+    builder.exportMidi(notes, kSourceSampleRate, file.getFile());
+  }
+
+  setFrameCounters(state, numFrames);
+}
+
+BENCHMARK(BM_PrepareAudio)->Apply(inputLengths);
+BENCHMARK(BM_ComputeFeatures)->Apply(inputLengths);
+BENCHMARK(BM_CNNFrameInference)->Apply(inputLengths);
+BENCHMARK(BM_NotesConvertNewAudio)->Apply(inputLengths);
+BENCHMARK(BM_NotesConvertUpdate)->Apply(inputLengths);
+BENCHMARK(BM_InferredOnsets)->Apply(inputLengths);
+BENCHMARK(BM_AddPitchBends)->Apply(inputLengths);
+BENCHMARK(BM_QuantizeToChords)->Apply(inputLengths);
+BENCHMARK(BM_ExportMidi)->Apply(inputLengths);
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  // JSON results by default, next to the console report
+  std::vector<char *> args(argv, argv + argc);
+  std::string out = "--benchmark_out=Sample2MIDI_bench.json";
+  std::string format = "--benchmark_out_format=json";
+
+  bool hasOut = false;
+  for (int i = 1; i < argc; ++i)
+    hasOut = hasOut || std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+
+  if (!hasOut) {
+    args.push_back(out.data());
+    args.push_back(format.data());
+  }
+
+  int numArgs = (int)args.size();
+  benchmark::Initialize(&numArgs, args.data());
+  if (benchmark::ReportUnrecognizedArguments(numArgs, args.data()))
+    return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}